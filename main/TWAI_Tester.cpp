@@ -18,24 +18,94 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <atomic>
+
 #include "driver/gpio.h"
 #include "driver/twai.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_random.h"
 #include "esp_rom_gpio.h"
 #include "esp_rom_sys.h"
+#include "acceptance_filter.h"
+#include "benchmark_suite.h"
+#include "bus_load.h"
+#include "bus_recovery.h"
+#include "controller_health.h"
+#include "diag_benchmark.h"
+#include "diag_log.h"
+#include "driver_gate.h"
+#include "esp_timer.h"
+#include "expected_frames.h"
+#include "fault_injection.h"
+#include "frame_pool.h"
+#include "frame_stream.h"
+#include "frame_trace.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "incident_log.h"
+#include "jitter_histogram.h"
+#include "latency_profiler.h"
+#include "loopback_frame.h"
+#include "node_emulator.h"
+#include "queue_benchmark.h"
+#include "second_controller.h"
 #include "soc/gpio_sig_map.h"   // For GPIO matrix signal index
+#include "spsc_ring.h"
 #include "string.h"
+#include "task_monitor.h"
+#include "tester_console.h"
+#include "tester_stats.h"
+#include "tx_scheduler.h"
+#include "udp_gateway.h"
 
 /* --------------------- Definitions and static variables ------------------ */
 // Example Configuration
 #define TX_GPIO_NUM GPIO_NUM_33
 #define RX_GPIO_NUM GPIO_NUM_32
-#define TX_TASK_PRIO 9
-#define CTRL_TASK_PRIO 11
+
+// Task placement, see "TWAI Tester Configuration" in menuconfig
+#define TX_TASK_PRIO CONFIG_TWAI_TESTER_TX_TASK_PRIO
+#define TX_TASK_CORE CONFIG_TWAI_TESTER_TX_TASK_CORE
+#define CTRL_TASK_PRIO CONFIG_TWAI_TESTER_CTRL_TASK_PRIO
+#define CTRL_TASK_CORE CONFIG_TWAI_TESTER_CTRL_TASK_CORE
+#define RX_TASK_PRIO CONFIG_TWAI_TESTER_RX_TASK_PRIO
+#define RX_TASK_CORE CONFIG_TWAI_TESTER_RX_TASK_CORE
+#define ANALYSIS_TASK_PRIO CONFIG_TWAI_TESTER_ANALYSIS_TASK_PRIO
+#define ANALYSIS_TASK_CORE CONFIG_TWAI_TESTER_ANALYSIS_TASK_CORE
+#define TWAI_ISR_CORE CONFIG_TWAI_TESTER_ISR_CORE
+#define STATS_TASK_PRIO 1
+#define TASK_STACK_SIZE CONFIG_TWAI_TESTER_TASK_STACK_SIZE
+
+// Driver queue lengths
+#define TX_QUEUE_LEN CONFIG_TWAI_TESTER_TX_QUEUE_LEN
+#define RX_QUEUE_LEN CONFIG_TWAI_TESTER_RX_QUEUE_LEN
+
+// RX Configuration
+#define RX_BATCH_SIZE CONFIG_TWAI_TESTER_RX_BATCH_SIZE
+#define RX_REPORT_INTERVAL_MS CONFIG_TWAI_TESTER_RX_REPORT_INTERVAL_MS
+#define RX_RING_SIZE CONFIG_TWAI_TESTER_RX_RING_SIZE
+#define JITTER_MSG_ID CONFIG_TWAI_TESTER_JITTER_MSG_ID
+#define JITTER_REPORT_INTERVAL_MS CONFIG_TWAI_TESTER_JITTER_REPORT_INTERVAL_MS
+
+// Second controller, only on targets with more than one
+#if CONFIG_TWAI_TESTER_SECOND_CONTROLLER
+#define SECOND_TX_GPIO_NUM ((gpio_num_t)CONFIG_TWAI_TESTER_SECOND_TX_GPIO)
+#define SECOND_RX_GPIO_NUM ((gpio_num_t)CONFIG_TWAI_TESTER_SECOND_RX_GPIO)
+#endif
+#if CONFIG_TWAI_TESTER_SECOND_ROLE_LOAD
+#define LOOPBACK_PROBE_ID CONFIG_TWAI_TESTER_SECOND_PROBE_ID
+#endif
+
+// Self test loopback, the controller receives its own frames without ACK from another node
+#if CONFIG_TWAI_TESTER_TX_MODE_SELF_TEST
+#define TWAI_MODE TWAI_MODE_NO_ACK
+#define SELF_TEST_ID CONFIG_TWAI_TESTER_SELF_TEST_ID
+#define SELF_TEST_RATE CONFIG_TWAI_TESTER_SELF_TEST_RATE
+#else
+#define TWAI_MODE TWAI_MODE_NORMAL
+#endif
 
 #define EXAMPLE_TAG "TWAI Alert and Recovery"
 
@@ -45,7 +115,7 @@ struct _twai_alert_name_t {
     const uint32_t alert;
     const char *name;
     const bool report;
-} static const _alert_name_list[]{
+} static constexpr _alert_name_list[]{
     // clang-format off
      {TWAI_ALERT_TX_IDLE,                "TX_IDLE",              false},
      {TWAI_ALERT_TX_SUCCESS,             "TX_SUCCESS",           false},
@@ -66,9 +136,48 @@ struct _twai_alert_name_t {
      {TWAI_ALERT_PERIPH_RESET,           "PERIPH_RESET",         true},
     // clang-format on
 };
-static const uint32_t _alert_name_list_size =
+static constexpr uint32_t _alert_name_list_size =
     sizeof(_alert_name_list) / sizeof(_alert_name_list[0]);
 
+// The alert bit position is used as index into _alert_name_list
+static constexpr bool _alert_name_list_is_bit_ordered() {
+    for (uint32_t i = 0; i < _alert_name_list_size; ++i) {
+        if (_alert_name_list[i].alert != (1u << i)) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(_alert_name_list_is_bit_ordered(), "Alert list must be ordered by bit position");
+static_assert((1u << _alert_name_list_size) - 1 == TWAI_ALERT_ALL, "Alert list incomplete");
+
+// All alerts which are reported, besides them BUS_OFF/BUS_RECOVERED are handled by ctrl_task
+static constexpr uint32_t _reported_alerts() {
+    uint32_t alerts = 0;
+    for (uint32_t i = 0; i < _alert_name_list_size; ++i) {
+        if (_alert_name_list[i].report) {
+            alerts |= _alert_name_list[i].alert;
+        }
+    }
+    return alerts;
+}
+
+#if CONFIG_TWAI_TESTER_ALERTS_REPORTED_ONLY
+#define ALERTS_ENABLED (_reported_alerts() | TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED)
+#else
+#define ALERTS_ENABLED TWAI_ALERT_ALL
+#endif
+#if CONFIG_TWAI_TESTER_RX_EVENT_LOOP
+// RX_DATA wakes up the event loop, but is only counted if it is enabled anyway
+#define ALERTS_WAITED (ALERTS_ENABLED | TWAI_ALERT_RX_DATA)
+#else
+#define ALERTS_WAITED ALERTS_ENABLED
+#endif
+#define ALERT_REPORT_INTERVAL_MS CONFIG_TWAI_TESTER_ALERT_REPORT_INTERVAL_MS
+
+// Number of occurrences of each alert, indexed by bit position. Only written by ctrl_task.
+static uint32_t alert_counts[_alert_name_list_size];
+
 static void can_messages_router_print_status(twai_status_info_t status_info,
                                              esp_log_level_t log_level) {
     ESP_LOG_LEVEL_LOCAL(log_level, TAG,
@@ -84,26 +193,63 @@ static void can_messages_router_print_status(twai_status_info_t status_info,
 }
 
 // CAN Settings
-static const twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+#if CONFIG_TWAI_TESTER_TX_MODE_SELF_TEST
+#define FILTER_MODE ACCEPTANCE_FILTER_ALL   // The own frames are not in the expected frame table
+#elif CONFIG_TWAI_TESTER_FILTER_SINGLE
+#define FILTER_MODE ACCEPTANCE_FILTER_SINGLE
+#elif CONFIG_TWAI_TESTER_FILTER_DUAL
+#define FILTER_MODE ACCEPTANCE_FILTER_DUAL
+#else
+#define FILTER_MODE ACCEPTANCE_FILTER_ALL
+#endif
+static const twai_filter_config_t f_config = acceptance_filter_from_table(FILTER_MODE);
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
 static const twai_timing_config_t t_config = []() {
+#if CONFIG_TWAI_TESTER_BITRATE_25K
+    twai_timing_config_t config = TWAI_TIMING_CONFIG_25KBITS();
+#elif CONFIG_TWAI_TESTER_BITRATE_50K
+    twai_timing_config_t config = TWAI_TIMING_CONFIG_50KBITS();
+#elif CONFIG_TWAI_TESTER_BITRATE_100K
+    twai_timing_config_t config = TWAI_TIMING_CONFIG_100KBITS();
+#elif CONFIG_TWAI_TESTER_BITRATE_250K
+    twai_timing_config_t config = TWAI_TIMING_CONFIG_250KBITS();
+#elif CONFIG_TWAI_TESTER_BITRATE_500K
+    twai_timing_config_t config = TWAI_TIMING_CONFIG_500KBITS();
+#elif CONFIG_TWAI_TESTER_BITRATE_800K
+    twai_timing_config_t config = TWAI_TIMING_CONFIG_800KBITS();
+#elif CONFIG_TWAI_TESTER_BITRATE_1M
+    twai_timing_config_t config = TWAI_TIMING_CONFIG_1MBITS();
+#elif CONFIG_TWAI_TESTER_BITRATE_CUSTOM
+    static_assert(CONFIG_TWAI_TESTER_CUSTOM_BRP % 2 == 0, "BRP must be even");
+    static_assert(CONFIG_TWAI_TESTER_CUSTOM_SJW <= CONFIG_TWAI_TESTER_CUSTOM_TSEG2,
+                  "SJW must not exceed TSEG2");
+    twai_timing_config_t config = {};
+    config.brp = CONFIG_TWAI_TESTER_CUSTOM_BRP;   // Used by the driver as quanta_resolution_hz is 0
+    config.tseg_1 = CONFIG_TWAI_TESTER_CUSTOM_TSEG1;
+    config.tseg_2 = CONFIG_TWAI_TESTER_CUSTOM_TSEG2;
+    config.sjw = CONFIG_TWAI_TESTER_CUSTOM_SJW;
+#if CONFIG_TWAI_TESTER_CUSTOM_TRIPLE_SAMPLING
+    config.triple_sampling = true;
+#endif
+#else
     twai_timing_config_t config = TWAI_TIMING_CONFIG_125KBITS();
+#endif
     config.clk_src = TWAI_CLK_SRC_DEFAULT;
     return config;
 }();
 #pragma GCC diagnostic pop
 
 static const twai_general_config_t g_config = {.controller_id = 0,
-                                               .mode = TWAI_MODE_NORMAL,
+                                               .mode = TWAI_MODE,
                                                .tx_io = TX_GPIO_NUM,
                                                .rx_io = RX_GPIO_NUM,
                                                .clkout_io = TWAI_IO_UNUSED,
                                                .bus_off_io = TWAI_IO_UNUSED,
-                                               .tx_queue_len = 20,
-                                               .rx_queue_len = 20,
-                                               .alerts_enabled = TWAI_ALERT_ALL,
+                                               .tx_queue_len = TX_QUEUE_LEN,
+                                               .rx_queue_len = RX_QUEUE_LEN,
+                                               .alerts_enabled = ALERTS_WAITED,
                                                .clkout_divider = 0,
                                                .intr_flags = ESP_INTR_FLAG_LEVEL1};
 
@@ -112,204 +258,1066 @@ static const twai_message_t tx_msg = {.flags = TWAI_MSG_FLAG_EXTD,
                                       .data_length_code = 8,
                                       .data = {0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef}};
 
+#if CONFIG_TWAI_TESTER_TX_MODE_SCHEDULER
+// Messages transmitted by the cyclic scheduler
+static const tx_cyclic_message_t tx_cyclic_messages[] = {
+    {.message = tx_msg, .period_us = 100 * 1000},
+    {.message = {.flags = TWAI_MSG_FLAG_EXTD,
+                 .identifier = 0x5001,
+                 .data_length_code = 8,
+                 .data = {0x10, 0x32, 0x54, 0x76, 0x98, 0xba, 0xdc, 0xfe}},
+     .period_us = 500},
+};
+#endif
+
+#if CONFIG_TWAI_TESTER_TX_MODE_NODE
+// Node set emulated in node mode, a mix of powertrain, body and diagnostic style messages
+static const node_message_t tx_node_messages[] = {
+    {.message = {.flags = TWAI_MSG_FLAG_NONE,
+                 .identifier = 0x0A0,
+                 .data_length_code = 8,
+                 .data = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88}},
+     .period_us = 10 * 1000},
+    {.message = {.flags = TWAI_MSG_FLAG_NONE,
+                 .identifier = 0x0C0,
+                 .data_length_code = 6,
+                 .data = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06}},
+     .period_us = 20 * 1000},
+    {.message = {.flags = TWAI_MSG_FLAG_NONE,
+                 .identifier = 0x120,
+                 .data_length_code = 4,
+                 .data = {0xde, 0xad, 0xbe, 0xef}},
+     .period_us = 5 * 1000},
+    {.message = {.flags = TWAI_MSG_FLAG_NONE,
+                 .identifier = 0x3E0,
+                 .data_length_code = 2,
+                 .data = {0x5a, 0xa5}},
+     .period_us = 0},
+    {.message = {.flags = TWAI_MSG_FLAG_NONE,
+                 .identifier = 0x410,
+                 .data_length_code = 8,
+                 .data = {0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80}},
+     .period_us = 50 * 1000},
+    {.message = {.flags = TWAI_MSG_FLAG_EXTD,
+                 .identifier = 0x18FEF100,
+                 .data_length_code = 8,
+                 .data = {0xff, 0xff, 0x00, 0x00, 0xff, 0xff, 0x00, 0x00}},
+     .period_us = 100 * 1000},
+    {.message = tx_msg, .period_us = 100 * 1000},
+};
+static_assert(sizeof(tx_node_messages) / sizeof(tx_node_messages[0]) <= NODE_EMULATOR_MAX_MESSAGES,
+              "Too many node messages");
+#endif
+
 static SemaphoreHandle_t tx_task_sem;
 static SemaphoreHandle_t ctrl_task_sem;
 
 /* --------------------------- Tasks and Functions -------------------------- */
 
-// TX Task to continuously transmit messages.
-static void tx_task(void *arg) {
-    xSemaphoreTake(tx_task_sem, portMAX_DELAY);
+// Transmit tx_msg every 100ms
+static void _tx_periodic_loop(void) {
     TickType_t pxPreviousWakeTime = xTaskGetTickCount();
     while (1) {
-        if (twai_transmit(&tx_msg, pdMS_TO_TICKS(100)) == ESP_ERR_INVALID_STATE) {
+        driver_gate_enter();
+        esp_err_t res = twai_transmit(&tx_msg, pdMS_TO_TICKS(100));
+        driver_gate_leave();
+        if (res == ESP_ERR_INVALID_STATE) {
             vTaskDelay(pdMS_TO_TICKS(500));
             continue;   // Just try to continuously transmit in 100ms interval
         }
         vTaskDelayUntil(&pxPreviousWakeTime, pdMS_TO_TICKS(100));
-        pxPreviousWakeTime = xTaskGetTickCount();
     }
-    vTaskDelete(NULL);
 }
 
-// Control task to check for errors and recover and restart the CAN-Bus when reaching a BUS_OFF
-// condition.
-static void ctrl_task(void *arg) {
-    xSemaphoreTake(ctrl_task_sem, portMAX_DELAY);
-    ESP_ERROR_CHECK(twai_start());
-    ESP_LOGI(EXAMPLE_TAG, "Driver started");
-    ESP_LOGI(EXAMPLE_TAG, "Starting transmissions");
-    xSemaphoreGive(tx_task_sem);   // Start transmit task
+#if CONFIG_TWAI_TESTER_TX_MODE_LOAD
+// Keep the driver TX queue full and report the achieved frame rate against the bus limit
+static void _tx_load_loop(void) {
+    const int64_t report_interval_us = CONFIG_TWAI_TESTER_TX_REPORT_INTERVAL_MS * 1000LL;
+    twai_message_t message = tx_msg;
+    message.data_length_code = CONFIG_TWAI_TESTER_TX_LOAD_DLC;
 
-    twai_reconfigure_alerts(TWAI_ALERT_ALL, NULL);
+    const uint32_t bitrate = twai_timing_bitrate(&t_config);
+    const uint32_t frame_bits = twai_frame_bits(&message, false);
+    const uint32_t frame_bits_stuffed = twai_frame_bits(&message, true);
+    ESP_LOGI(TAG, "TX load: %lu bit/s, %lu-%lu bits/frame, max. %lu-%lu frames/s", bitrate,
+             frame_bits, frame_bits_stuffed, twai_max_frame_rate(bitrate, frame_bits_stuffed),
+             twai_max_frame_rate(bitrate, frame_bits));
 
-    esp_err_t alertStatus;
-    uint32_t alerts;
-    bool stats_printed = false;
-    twai_status_info_t status_info;
+    uint32_t queued = 0;
+    uint32_t last_done = 0;
+    twai_status_info_t last_status = {};
+    driver_gate_enter();
+    twai_get_status_info(&last_status);
+    driver_gate_leave();
+    int64_t last_report_us = esp_timer_get_time();
 
     while (1) {
-        // Then check if there are can errors logged
-        alerts = 0;
-        stats_printed = false;
-        alertStatus = twai_read_alerts(&alerts, portMAX_DELAY);
-
-        if (alertStatus == ESP_OK) {
-            if (alerts != 0) {
-                // Print all raised alerts, if reporting of the occurred alert is enabled
-                for (uint32_t i = 0; i < _alert_name_list_size; ++i) {
-                    if (alerts & _alert_name_list[i].alert) {
-                        if (_alert_name_list[i].report) {
-                            // First print current CAN Status, if there was an issue, but only
-                            // do this once each round
-                            if (stats_printed == false) {
-                                esp_err_t res = twai_get_status_info(&status_info);
-                                if (res == ESP_OK) {
-                                    // Print TWAI status
-                                    can_messages_router_print_status(status_info, ESP_LOG_DEBUG);
-                                    stats_printed = true;
-                                } else {
-                                    // Print error
-                                    ESP_LOGW(TAG, "Could not get twai status: %s.",
-                                             esp_err_to_name(res));
-                                }
-                            }
-                            // Then print the alert cause
-                            ESP_LOGD(TAG, "!!! ALERT !!!: %s (%lx/%lx)", _alert_name_list[i].name,
-                                     _alert_name_list[i].alert, alerts);
-
-                        } else {
-                            ESP_LOGD(TAG, "!!! ALERT !!!: %s (%lx/%lx)", _alert_name_list[i].name,
-                                     _alert_name_list[i].alert, alerts);
-                        }
-                    }
-                }
-
-                if (alerts & TWAI_ALERT_BUS_OFF) {
-                    ESP_LOGI(EXAMPLE_TAG, "Bus Off state");
-                    // Prepare to initiate bus recovery, reconfigure alerts to detect bus recovery
-                    // completion
-                    // twai_reconfigure_alerts(TWAI_ALERT_BUS_RECOVERED, NULL);
-                    for (int i = 3; i > 0; i--) {
-                        ESP_LOGW(EXAMPLE_TAG, "Initiate bus recovery in %d", i);
-                        vTaskDelay(pdMS_TO_TICKS(1000));
-                    }
-                    twai_initiate_recovery();   // Needs 128 occurrences of bus free signal
-                    ESP_LOGI(EXAMPLE_TAG, "Initiate bus recovery");
-                }
-                if (alerts & TWAI_ALERT_BUS_RECOVERED) {
-                    // Bus recovery was successful, exit control task to uninstall driver
-                    ESP_LOGI(EXAMPLE_TAG, "Bus Recovered");
-
-                    ESP_ERROR_CHECK(twai_start());
-                    ESP_LOGI(EXAMPLE_TAG, "Driver started again");
-                    continue;
-                }
+        driver_gate_enter();
+        esp_err_t res = twai_transmit(&message, pdMS_TO_TICKS(10));
+        driver_gate_leave();
+        if (res == ESP_OK) {
+            queued++;
+        } else if (res == ESP_ERR_INVALID_STATE) {
+            vTaskDelay(pdMS_TO_TICKS(500));   // Bus off or not started
+        }
+
+        int64_t now_us = esp_timer_get_time();
+        if (now_us - last_report_us < report_interval_us) {
+            continue;
+        }
+
+        twai_status_info_t status;
+        driver_gate_enter();
+        res = twai_get_status_info(&status);
+        driver_gate_leave();
+        if (res != ESP_OK) {
+            continue;
+        }
+        // Frames which left the queue either were sent or failed
+        uint32_t done = queued - status.msgs_to_tx;
+        uint32_t failed = status.tx_failed_count - last_status.tx_failed_count;
+        uint32_t sent = done - last_done - failed;
+        uint32_t elapsed_ms = (now_us - last_report_us) / 1000;
+        uint32_t frames_per_s = (uint64_t)sent * 1000 / elapsed_ms;
+        // Bus load in 1/10 percent based on the frame length without stuff bits
+        uint32_t load_permille = (uint64_t)frames_per_s * frame_bits * 1000 / bitrate;
+
+        ESP_LOGI(TAG,
+                 "TX load: %lu frames/s, bus load: %lu.%lu%%, failed: %lu/s, arb lost: %lu/s, "
+                 "queued: %lu",
+                 frames_per_s, load_permille / 10, load_permille % 10,
+                 (uint32_t)((uint64_t)failed * 1000 / elapsed_ms),
+                 (uint32_t)((uint64_t)(status.arb_lost_count - last_status.arb_lost_count) * 1000 /
+                            elapsed_ms),
+                 status.msgs_to_tx);
+
+        last_done = done;
+        last_status = status;
+        last_report_us = now_us;
+    }
+}
+#endif
+
+#if CONFIG_TWAI_TESTER_TX_MODE_SCHEDULER
+// Transmit the cyclic message table from esp_timer callbacks and report the period jitter
+static void _tx_scheduler_loop(void) {
+    ESP_ERROR_CHECK(tx_scheduler_start(tx_cyclic_messages,
+                                       sizeof(tx_cyclic_messages) / sizeof(tx_cyclic_messages[0])));
+    TickType_t pxPreviousWakeTime = xTaskGetTickCount();
+    while (1) {
+        vTaskDelayUntil(&pxPreviousWakeTime,
+                        pdMS_TO_TICKS(CONFIG_TWAI_TESTER_TX_REPORT_INTERVAL_MS));
+        tx_scheduler_print_stats(TAG);
+    }
+}
+#endif
+
+#if CONFIG_TWAI_TESTER_TX_MODE_NODE
+// Emulate the node set, trigger its event driven messages at random and report the counters
+static void _tx_node_loop(void) {
+    const size_t count = sizeof(tx_node_messages) / sizeof(tx_node_messages[0]);
+    const node_emulator_config_t config = {.max_in_flight = CONFIG_TWAI_TESTER_TX_NODE_IN_FLIGHT,
+                                           .bitrate = twai_timing_bitrate(&t_config),
+                                           .core = TX_TASK_CORE,
+                                           .priority = TX_TASK_PRIO + 1};
+    ESP_ERROR_CHECK(node_emulator_start(tx_node_messages, count, &config));
+
+    const uint32_t event_mean_ms = CONFIG_TWAI_TESTER_TX_NODE_EVENT_MEAN_MS;
+    TickType_t last_report = xTaskGetTickCount();
+    while (1) {
+        // Uniform between 0 and twice the mean interval
+        vTaskDelay(pdMS_TO_TICKS(esp_random() % (2 * event_mean_ms + 1)) + 1);
+        for (size_t i = 0; i < count; ++i) {
+            if (tx_node_messages[i].period_us == 0) {
+                node_emulator_trigger(i);
             }
         }
+        if (xTaskGetTickCount() - last_report >=
+            pdMS_TO_TICKS(CONFIG_TWAI_TESTER_TX_REPORT_INTERVAL_MS)) {
+            node_emulator_print_stats(TAG);
+            last_report = xTaskGetTickCount();
+        }
     }
+}
+#endif
 
-    xSemaphoreGive(ctrl_task_sem);
+#if CONFIG_TWAI_TESTER_TX_MODE_SELF_TEST
+// Transmit stamped frames for the self test, with SELF_TEST_RATE or as fast as the TX queue
+// accepts them. A rate the bus cannot carry is caught up later in bursts.
+static void _tx_self_test_loop(void) {
+    const int64_t report_interval_us = CONFIG_TWAI_TESTER_TX_REPORT_INTERVAL_MS * 1000LL;
+    twai_message_t message = {};
+    message.self = 1;
+    message.identifier = SELF_TEST_ID;
+    message.data_length_code = LOOPBACK_FRAME_DLC;
+    ESP_LOGI(TAG, "Self test: ID 0x%x, %d frames/s (0: max.), bus max. %lu frames/s",
+             SELF_TEST_ID, SELF_TEST_RATE,
+             twai_max_frame_rate(twai_timing_bitrate(&t_config), twai_frame_bits(&message, false)));
+
+    uint32_t sequence = 0;
+    uint32_t timeouts = 0;
+    uint32_t reported = 0;
+    const int64_t start_us = esp_timer_get_time();
+    int64_t last_report_us = start_us;
+    while (1) {
+        const int64_t now_us = esp_timer_get_time();
+        if (now_us - last_report_us >= report_interval_us) {
+            ESP_LOGI(TAG, "Self test TX: %lu frames/s, queue timeouts: %lu",
+                     (uint32_t)((uint64_t)(sequence - reported) * 1000000 /
+                                (now_us - last_report_us)),
+                     timeouts);
+            reported = sequence;
+            last_report_us = now_us;
+        }
+        if (SELF_TEST_RATE != 0 && sequence >= (now_us - start_us) * SELF_TEST_RATE / 1000000) {
+            vTaskDelay(1);
+            continue;
+        }
+
+        loopback_frame_stamp(&message, sequence);
+        driver_gate_enter();
+        esp_err_t res = twai_transmit(&message, pdMS_TO_TICKS(10));
+        driver_gate_leave();
+        if (res == ESP_OK) {
+            sequence++;
+        } else if (res == ESP_ERR_TIMEOUT) {
+            timeouts++;
+        } else {
+            vTaskDelay(pdMS_TO_TICKS(500));   // Bus off or not started
+        }
+    }
+}
+#endif
+
+// TX Task to continuously transmit messages.
+static void tx_task(void *arg) {
+    xSemaphoreTake(tx_task_sem, portMAX_DELAY);
+#if CONFIG_TWAI_TESTER_TX_MODE_LOAD
+    _tx_load_loop();
+#elif CONFIG_TWAI_TESTER_TX_MODE_SCHEDULER
+    _tx_scheduler_loop();
+#elif CONFIG_TWAI_TESTER_TX_MODE_SELF_TEST
+    _tx_self_test_loop();
+#elif CONFIG_TWAI_TESTER_TX_MODE_NODE
+    _tx_node_loop();
+#else
+    _tx_periodic_loop();
+#endif
     vTaskDelete(NULL);
 }
 
-// Sample data sent by PCAN in 10ms interval
-uint8_t sample_data[8] = {0xAB, 0xCD, 0xEF, 0x01, 0x23, 0x45, 0x67, 0x89};
+// Count each raised alert, visiting only the set bits
+static void _count_alerts(uint32_t alerts) {
+    alerts &= TWAI_ALERT_ALL;
+    while (alerts != 0) {
+        alert_counts[__builtin_ctz(alerts)]++;
+        alerts &= alerts - 1;
+    }
+}
+
+// Print one line with all alerts raised since the last summary. If any of them is to be
+// reported, the line is printed as warning together with the current TWAI status.
+static void _print_alert_summary(uint32_t *reported_counts) {
+    char summary[256];
+    size_t len = 0;
+    bool report = false;
 
-// Check if the received data matches the sample data
-static void _check_my_message(twai_message_t *canMessage) {
-    static uint32_t message_cnt = 0;
-    if (canMessage->identifier == 0x1) {
-        if (canMessage->data_length_code != 8) {
-            goto error;
+    for (uint32_t i = 0; i < _alert_name_list_size; ++i) {
+        uint32_t delta = alert_counts[i] - reported_counts[i];
+        if (delta == 0) {
+            continue;
         }
-        if (memcmp(canMessage->data, sample_data, sizeof(sample_data)) == 0) {
-            // Everything fine
-            message_cnt++;
-            return;
+        reported_counts[i] = alert_counts[i];
+        report |= _alert_name_list[i].report;
+        if (len < sizeof(summary)) {
+            len += snprintf(&summary[len], sizeof(summary) - len, " %s: %lu,",
+                            _alert_name_list[i].name, delta);
+        }
+    }
+    if (len == 0) {
+        return;
+    }
+    if (len < sizeof(summary)) {
+        summary[len - 1] = '\0';   // Drop the trailing comma
+    }
+
+    if (report) {
+        ESP_LOGW(TAG, "Alerts:%s", summary);
+        twai_status_info_t status_info;
+        esp_err_t res = twai_get_status_info(&status_info);
+        if (res == ESP_OK) {
+            // Print TWAI status
+            can_messages_router_print_status(status_info, ESP_LOG_INFO);
         } else {
-            // The received message does not match the sample buffer => Print the corrupt message
-            goto error;
+            // Print error
+            ESP_LOGW(TAG, "Could not get twai status: %s.", esp_err_to_name(res));
         }
+    } else {
+        ESP_LOGD(TAG, "Alerts:%s", summary);
+    }
+}
+
+// Frame as handed over from the RX task to the analysis task
+typedef struct {
+    twai_message_t message;
+    int64_t timestamp_us;   // esp_timer time when the frame was taken from the driver queue
+} rx_frame_t;
+
+// The RX task receives directly into pool slots and passes them on by pointer, so a frame is not
+// copied again on its way through the ring and the analysis stages. The pool covers a full ring,
+// one batch in the analysis task and the slot the RX task receives into.
+static FramePool<rx_frame_t, RX_RING_SIZE + RX_BATCH_SIZE + 1> rx_frame_pool;
+static SpscRing<rx_frame_t *, RX_RING_SIZE> rx_ring;
+static rx_frame_t rx_spare_frame;   // Receive target if the pool is exhausted, always dropped
+static TaskHandle_t analysis_task_handle;
+
+// Inter-arrival times of the JITTER_MSG_ID frame, only accessed by the analysis task
+static JitterHistogram<CONFIG_TWAI_TESTER_JITTER_BUCKET_US, CONFIG_TWAI_TESTER_JITTER_BUCKETS>
+    reference_jitter;
+#if CONFIG_TWAI_TESTER_SECOND_ROLE_LOAD
+// Latency of the probes from the second controller, only accessed by the analysis task
+static JitterHistogram<CONFIG_TWAI_TESTER_JITTER_BUCKET_US, CONFIG_TWAI_TESTER_JITTER_BUCKETS>
+    loopback_latency;
+#endif
+#if CONFIG_TWAI_TESTER_TX_MODE_SELF_TEST
+// TX to RX latency and sequence check of the own frames, only accessed by the analysis task
+static JitterHistogram<CONFIG_TWAI_TESTER_JITTER_BUCKET_US, CONFIG_TWAI_TESTER_JITTER_BUCKETS>
+    self_test_latency;
+static loopback_sequence_t self_test_sequence;
+#endif
+
+// Per-frame log lines go through DIAG_LOGE, so they are rate limited or compiled out with
+// CONFIG_TWAI_TESTER_DIAG_LEVEL while the counters and the trace still record the frame
+static void _print_message(const twai_message_t *canMessage) {
+    DIAG_LOGE(TAG,
+              "\tMessage ID: 0x%lx (%li), len: %i, data: %02X %02X %02X %02X %02X %02X %02X %02X",
+              canMessage->identifier, canMessage->identifier, canMessage->data_length_code,
+              canMessage->data[0], canMessage->data[1], canMessage->data[2], canMessage->data[3],
+              canMessage->data[4], canMessage->data[5], canMessage->data[6], canMessage->data[7]);
+}
+
+#if CONFIG_TWAI_TESTER_HEALTH
+// Owned by ctrl_task, the analysis task only checks the quarantine window
+static controller_health_t controller_health;
+#endif
+
+// Whether a frame falls into a quarantine window of the controller health watchdog
+static bool _quarantined(const rx_frame_t *frame) {
+#if CONFIG_TWAI_TESTER_HEALTH
+    return controller_health_quarantined(&controller_health, frame->timestamp_us);
+#else
+    return false;
+#endif
+}
+
+// Hand a received frame to the enabled recorders. Stream and trace record quarantined frames as
+// well, only the gateway does not forward them.
+static void _capture_frame(const rx_frame_t *frame) {
+    LATENCY_PROFILE_BEGIN(start);
+#if CONFIG_TWAI_TESTER_STREAM
+    frame_stream_write_frame(&frame->message, frame->timestamp_us);
+#endif
+#if CONFIG_TWAI_TESTER_TRACE
+    frame_trace_record_frame(&frame->message, frame->timestamp_us);
+#endif
+#if CONFIG_TWAI_TESTER_UDP
+    if (!_quarantined(frame)) {
+        udp_gateway_write_frame(&frame->message, frame->timestamp_us);
+    }
+#endif
+    LATENCY_PROFILE_END(PROFILE_STAGE_CAPTURE, start);
+}
+
+// Freeze the trace around a frame which does not match the expected frame table and keep the
+// frame in the incident log
+static void _trigger_trace(const rx_frame_t *frame, check_result_t result) {
+#if CONFIG_TWAI_TESTER_TRACE
+    if (result == CHECK_DLC_ERROR) {
+        frame_trace_trigger(FRAME_TRACE_TRIGGER_DLC_ERROR, frame->timestamp_us);
+    } else if (result == CHECK_DATA_ERROR) {
+        frame_trace_trigger(FRAME_TRACE_TRIGGER_DATA_ERROR, frame->timestamp_us);
+    }
+#endif
+#if CONFIG_TWAI_TESTER_INCIDENT_LOG
+    if (result == CHECK_DLC_ERROR) {
+        incident_log_frame(INCIDENT_DLC_ERROR, &frame->message);
+    } else if (result == CHECK_DATA_ERROR) {
+        incident_log_frame(INCIDENT_DATA_ERROR, &frame->message);
+    }
+#endif
+}
+
+// Validate the frame against the expected frame table and count the result in total and per ID
+static check_result_t _check_frame(const rx_frame_t *frame, size_t *index) {
+    LATENCY_PROFILE_BEGIN(start);
+    check_result_t result = expected_frame_check(&frame->message, index);
+    switch (result) {
+        case CHECK_OK:
+            tester_stats_add(&tester_stats.frames_ok, 1);
+            break;
+        case CHECK_DLC_ERROR:
+            tester_stats_add(&tester_stats.frames_dlc_error, 1);
+            break;
+        case CHECK_DATA_ERROR:
+            tester_stats_add(&tester_stats.frames_data_error, 1);
+            break;
+        case CHECK_UNKNOWN_ID:
+            tester_stats_add(&tester_stats.frames_unknown_id, 1);
+            break;
+    }
+    if (result != CHECK_UNKNOWN_ID) {
+        expected_frame_record(*index, &frame->message, result, frame->timestamp_us);
+        _trigger_trace(frame, result);
+    }
+    LATENCY_PROFILE_END(PROFILE_STAGE_VALIDATE, start);
+    LATENCY_PROFILE_RECORD(PROFILE_STAGE_END_TO_END, esp_timer_get_time() - frame->timestamp_us);
+    return result;
+}
+
+// Self test frames and loopback probes are not part of the expected frame table, their latency
+// and sequence are measured by _record_timing() instead
+static bool _measured_only(const rx_frame_t *frame) {
+#if CONFIG_TWAI_TESTER_SECOND_ROLE_LOAD
+    if (frame->message.identifier == LOOPBACK_PROBE_ID && !frame->message.extd) {
+        return true;
+    }
+#endif
+#if CONFIG_TWAI_TESTER_TX_MODE_SELF_TEST
+    if (frame->message.identifier == SELF_TEST_ID && !frame->message.extd) {
+        return true;
+    }
+#endif
+    return false;
+}
+
+// Check if the received data matches the expected frame and print it otherwise
+static void _check_my_message(const rx_frame_t *frame) {
+    if (_measured_only(frame)) {
+        return;
+    }
+    if (_quarantined(frame)) {
+        tester_stats_add(&tester_stats.frames_quarantined, 1);
+        return;
+    }
+    size_t index;
+    const twai_message_t *canMessage = &frame->message;
+    check_result_t result = _check_frame(frame, &index);
+    if (result == CHECK_UNKNOWN_ID) {
+        _print_message(canMessage);
+        return;
+    }
+    if (result == CHECK_OK) {
+        // Everything fine
+        return;
+    }
+    // The received message does not match the expected frame => Print the corrupt message
+    DIAG_LOGE(TAG,
+              "\tMessage ID: 0x%lx (%li), len: %i, data: %02X %02X %02X %02X %02X %02X "
+              "%02X %02X, msg cnt: %lu",
+              canMessage->identifier, canMessage->identifier, canMessage->data_length_code,
+              canMessage->data[0], canMessage->data[1], canMessage->data[2], canMessage->data[3],
+              canMessage->data[4], canMessage->data[5], canMessage->data[6], canMessage->data[7],
+              expected_frame_stats(index)->frames_ok.load(std::memory_order_relaxed));
+}
+
+// Validate and count a received frame without logging it
+static void _check_counted(const rx_frame_t *frame) {
+    if (_measured_only(frame)) {
+        return;
     }
-error:
-    if (canMessage != NULL) {
-        ESP_LOGE(TAG,
-                 "\tMessage ID: 0x%lx (%li), len: %i, data: %02X %02X %02X %02X %02X %02X "
-                 "%02X %02X, msg cnt: %lu",
-                 canMessage->identifier, canMessage->identifier, canMessage->data_length_code,
-                 canMessage->data[0], canMessage->data[1], canMessage->data[2], canMessage->data[3],
-                 canMessage->data[4], canMessage->data[5], canMessage->data[6], canMessage->data[7],
-                 message_cnt);
+    if (_quarantined(frame)) {
+        tester_stats_add(&tester_stats.frames_quarantined, 1);
+        return;
     }
-    return;
+    size_t index;
+    _check_frame(frame, &index);
 }
 
-// RX Task to read messages from TWAI receive queue
+// Feed the receive timestamp of the reference frame into the inter-arrival histogram and the
+// latency of loopback probes into theirs
+static void _record_timing(const rx_frame_t *frame) {
+    if (frame->message.identifier == JITTER_MSG_ID) {
+        reference_jitter.record_arrival(frame->timestamp_us);
+    }
+#if CONFIG_TWAI_TESTER_SECOND_ROLE_LOAD
+    uint32_t latency_us;
+    if (second_controller_probe_latency(&frame->message, LOOPBACK_PROBE_ID, frame->timestamp_us,
+                                        &latency_us)) {
+        loopback_latency.add(latency_us);
+    }
+#endif
+#if CONFIG_TWAI_TESTER_TX_MODE_SELF_TEST
+    if (frame->message.identifier == SELF_TEST_ID && !frame->message.extd &&
+        frame->message.data_length_code == LOOPBACK_FRAME_DLC) {
+        self_test_latency.add(loopback_frame_latency_us(&frame->message, frame->timestamp_us));
+        loopback_sequence_record(&self_test_sequence, loopback_frame_sequence(&frame->message));
+    }
+#endif
+}
+
+// Print the counters of all expected frames which were received or are missing
+static void _print_expected_frames(void) {
+    for (size_t i = 0; i < expected_frame_count(); ++i) {
+        const expected_frame_t *expected = expected_frame_at(i);
+        const expected_frame_stats_t *stats = expected_frame_stats(i);
+        ESP_LOGI(TAG, "\tID 0x%lx: ok: %lu, dlc err: %lu, data err: %lu, late: %lu, early: %lu",
+                 expected->identifier, stats->frames_ok.load(std::memory_order_relaxed),
+                 stats->frames_dlc_error.load(std::memory_order_relaxed),
+                 stats->frames_data_error.load(std::memory_order_relaxed),
+                 stats->frames_late.load(std::memory_order_relaxed),
+                 stats->frames_early.load(std::memory_order_relaxed));
+        if (expected->e2e) {
+            const uint32_t ok = stats->frames_ok.load(std::memory_order_relaxed);
+            const uint32_t lost = stats->frames_lost.load(std::memory_order_relaxed);
+            ESP_LOG_LEVEL_LOCAL(lost != 0 ? ESP_LOG_WARN : ESP_LOG_INFO, TAG,
+                                "\t\tE2E: lost: %lu (%lu per 1000000), gaps: %lu, duplicates: %lu",
+                                lost, ok + lost ? (uint32_t)(1000000ull * lost / (ok + lost)) : 0,
+                                stats->counter_gaps.load(std::memory_order_relaxed),
+                                stats->frames_duplicate.load(std::memory_order_relaxed));
+        }
+    }
+}
+
+// Print and restart a histogram with its non-empty buckets
+template <typename Histogram>
+static void _print_histogram(const char *name, Histogram *histogram) {
+    ESP_LOGI(TAG,
+             "%s: n: %lu, min: %lu us, mean: %lu us, p50: %lu us, p99: %lu us, max: %lu us, "
+             "overflow: %lu",
+             name, histogram->count(), histogram->min_us(), histogram->mean_us(),
+             histogram->percentile_us(500), histogram->percentile_us(990), histogram->max_us(),
+             histogram->overflow());
+    for (size_t i = 0; i < histogram->bucket_count(); ++i) {
+        if (histogram->bucket(i) != 0) {
+            uint32_t lower_us = i * histogram->bucket_width_us();
+            ESP_LOGI(TAG, "\t[%5lu, %5lu) us: %lu", lower_us,
+                     lower_us + histogram->bucket_width_us(), histogram->bucket(i));
+        }
+    }
+    histogram->reset();
+}
+
+#if CONFIG_TWAI_TESTER_TX_MODE_SELF_TEST
+// Print the received rate, the sequence check and the latency of the own frames
+static void _print_self_test(void) {
+    static TickType_t last_report = xTaskGetTickCount();
+    static uint32_t reported = 0;
+    const TickType_t now = xTaskGetTickCount();
+    const TickType_t elapsed = now - last_report;
+    const loopback_sequence_t *sequence = &self_test_sequence;
+    ESP_LOGI(TAG, "Self test RX: %lu frames/s, received: %lu, lost: %lu, out of order: %lu",
+             (uint32_t)((uint64_t)(sequence->received - reported) * 1000 /
+                        (elapsed * portTICK_PERIOD_MS)),
+             sequence->received, sequence->lost, sequence->out_of_order);
+    reported = sequence->received;
+    last_report = now;
+    _print_histogram("Self test TX to RX latency", &self_test_latency);
+}
+#endif
+
+// Dump and restart the histograms once per JITTER_REPORT_INTERVAL_MS
+static void _report_timing_if_due(void) {
+    static TickType_t last_report = xTaskGetTickCount();
+    TickType_t now = xTaskGetTickCount();
+    if (now - last_report < pdMS_TO_TICKS(JITTER_REPORT_INTERVAL_MS)) {
+        return;
+    }
+    last_report = now;
+
+    char name[32];
+    snprintf(name, sizeof(name), "0x%x inter-arrival", JITTER_MSG_ID);
+    _print_histogram(name, &reference_jitter);
+#if CONFIG_TWAI_TESTER_SECOND_ROLE_LOAD
+    _print_histogram("Loopback latency", &loopback_latency);
+#endif
+#if CONFIG_TWAI_TESTER_TX_MODE_SELF_TEST
+    _print_self_test();
+#endif
+
+    _print_expected_frames();
+#if CONFIG_TWAI_TESTER_PROFILER
+    latency_profiler_print(TAG);
+#endif
+}
+
+// Analysis loop which empties the frame ring on each wakeup and only reports aggregated counters,
+// so the task does not fall behind the bus because of UART formatting.
+static void _analysis_drain_loop(void) {
+    rx_frame_t *batch[RX_BATCH_SIZE];
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(RX_REPORT_INTERVAL_MS));
+
+        size_t count;
+        while ((count = rx_ring.pop_batch(batch, RX_BATCH_SIZE)) != 0) {
+            tester_stats_max(&tester_stats.max_ring_latency_us,
+                             esp_timer_get_time() - batch[0]->timestamp_us);
+            // Check each frame right after recording it, so a trace trigger marks this frame
+            for (size_t i = 0; i < count; ++i) {
+                _record_timing(batch[i]);
+                _capture_frame(batch[i]);
+                _check_counted(batch[i]);
+                rx_frame_pool.release(batch[i]);
+            }
+        }
+#if CONFIG_TWAI_TESTER_TRACE
+        frame_trace_dump_if_frozen(TAG);
+#endif
+        _report_timing_if_due();
+    }
+}
+
+// Analysis loop which handles and logs every single message
+static void _analysis_single_loop(void) {
+    rx_frame_t *frame;
+    uint32_t timeouts = 0;
+    uint32_t errors = 0;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+
+        while (rx_ring.pop(&frame)) {
+            _record_timing(frame);
+            _capture_frame(frame);
+            _check_my_message(frame);
+            rx_frame_pool.release(frame);
+        }
+#if CONFIG_TWAI_TESTER_TRACE
+        frame_trace_dump_if_frozen(TAG);
+#endif
+
+        uint32_t value = tester_stats.rx_timeouts.load(std::memory_order_relaxed);
+        if (value != timeouts) {
+            ESP_LOGE(TAG, "CAN receive timed out");
+            timeouts = value;
+        }
+        value = tester_stats.rx_errors.load(std::memory_order_relaxed);
+        if (value != errors) {
+            ESP_LOGE(TAG, "Error receiving Message: %s",
+                     esp_err_to_name(tester_stats.rx_last_error.load()));
+            errors = value;
+        }
+        _report_timing_if_due();
+    }
+}
+
+// Analysis Task to validate and log the frames buffered by the RX task
+static void analysis_task(void *arg) {
+    ESP_LOGI(TAG, "Analysis Task started");
+
+#if CONFIG_TWAI_TESTER_RX_DRAIN_MODE
+    _analysis_drain_loop();
+#else
+    _analysis_single_loop();
+#endif
+
+    vTaskDelete(NULL);
+}
+
+// Slot for the next frame to receive
+static rx_frame_t *_alloc_rx_frame(void) {
+    rx_frame_t *frame = rx_frame_pool.alloc();
+    return frame != nullptr ? frame : &rx_spare_frame;
+}
+
+// Pass the ownership of a received frame to the analysis task
+static void _hand_over_rx_frame(rx_frame_t *frame) {
+    if (frame == &rx_spare_frame) {
+        tester_stats_add(&tester_stats.ring_drops, 1);
+    } else if (!rx_ring.push(frame)) {
+        rx_frame_pool.release(frame);
+        tester_stats_add(&tester_stats.ring_drops, 1);
+    }
+}
+
+// Dequeue a frame from the driver without blocking
+static bool _receive_pending(rx_frame_t *frame) {
+    LATENCY_PROFILE_BEGIN(start);
+    if (twai_receive(&frame->message, 0) != ESP_OK) {
+        return false;
+    }
+    LATENCY_PROFILE_END(PROFILE_STAGE_RECEIVE, start);
+    return true;
+}
+
+// Hand over the frame just received into *frame and everything else already queued without
+// blocking, up to RX_BATCH_SIZE frames, then wake up the analysis task. The timestamp is taken
+// first thing after each dequeue, as the controller does not provide one.
+static void _hand_over_rx_batch(rx_frame_t **frame) {
+    uint32_t count = 0;
+    do {
+        (*frame)->timestamp_us = esp_timer_get_time();
+        LATENCY_PROFILE_BEGIN(start);
+        _hand_over_rx_frame(*frame);
+        *frame = _alloc_rx_frame();
+        LATENCY_PROFILE_END(PROFILE_STAGE_HAND_OVER, start);
+        count++;
+    } while (count < RX_BATCH_SIZE && _receive_pending(*frame));
+
+    tester_stats_add(&tester_stats.rx_wakeups, 1);
+    tester_stats_max(&tester_stats.rx_max_batch, count);
+    xTaskNotifyGive(analysis_task_handle);
+}
+
+#if !CONFIG_TWAI_TESTER_RX_EVENT_LOOP
+// RX Task to read messages from TWAI receive queue. It only timestamps the frames and hands them
+// over to the analysis task, so slow validation or logging can never back up the driver queue.
 static void rx_task(void *arg) {
     ESP_LOGI(TAG, "Receive Task started");
 
-    esp_err_t receiveStatus;
-    twai_message_t message;
+    rx_frame_t *frame = _alloc_rx_frame();
     while (1) {
-        receiveStatus = twai_receive(&message, pdMS_TO_TICKS(1000));
+        driver_gate_enter();
+        esp_err_t receiveStatus =
+            twai_receive(&frame->message, pdMS_TO_TICKS(DRIVER_GATE_MAX_HOLD_MS));
 
         switch (receiveStatus) {
             case ESP_OK: {
-                // Handle Message
-                switch (message.identifier) {
-                    case 0x1: {
-                        // compare to other message
-                        _check_my_message(&message);
-                        break;
-                    }
-                    default: {
-                        ESP_LOGE(TAG,
-                                 "\tMessage ID: 0x%lx (%li), len: %i, data: %02X %02X %02X "
-                                 "%02X %02X %02X "
-                                 "%02X %02X",
-                                 message.identifier, message.identifier, message.data_length_code,
-                                 message.data[0], message.data[1], message.data[2], message.data[3],
-                                 message.data[4], message.data[5], message.data[6],
-                                 message.data[7]);
-                        break;
-                    }
-                }
+                _hand_over_rx_batch(&frame);
                 break;
             }
 
             case ESP_ERR_TIMEOUT: {
-                ESP_LOGE(TAG, "CAN receive timed out");
+                tester_stats_add(&tester_stats.rx_timeouts, 1);
                 break;
             }
 
             default: {
-                ESP_LOGE(TAG, "Error receiving Message: %s", esp_err_to_name(receiveStatus));
+                tester_stats.rx_last_error.store(receiveStatus, std::memory_order_relaxed);
+                tester_stats_add(&tester_stats.rx_errors, 1);
+                vTaskDelay(pdMS_TO_TICKS(10));   // e.g. driver not installed yet
                 break;
             }
         }
+        driver_gate_leave();
     }
 
     vTaskDelete(NULL);
 }
+#endif
+
+// Count and forward raised alerts, then run the bus off handling
+static void _handle_alerts(uint32_t alerts, bus_recovery_t *recovery) {
+#if CONFIG_TWAI_TESTER_STREAM || CONFIG_TWAI_TESTER_TRACE || CONFIG_TWAI_TESTER_UDP
+    const int64_t alerts_us = esp_timer_get_time();
+#endif
+#if CONFIG_TWAI_TESTER_STREAM
+    frame_stream_write_alerts(alerts, alerts_us);
+#endif
+#if CONFIG_TWAI_TESTER_TRACE
+    frame_trace_record_alerts(alerts, alerts_us);
+#endif
+#if CONFIG_TWAI_TESTER_UDP
+    udp_gateway_write_alerts(alerts, alerts_us);
+#endif
+    _count_alerts(alerts);
+    if (alerts & TWAI_ALERT_BUS_OFF) {
+        tester_stats_add(&tester_stats.bus_off, 1);
+    }
+    if (alerts & TWAI_ALERT_BUS_RECOVERED) {
+        tester_stats_add(&tester_stats.recoveries, 1);
+    }
+    // Bus off handling and restart after BUS_RECOVERED
+#if CONFIG_TWAI_TESTER_INCIDENT_LOG
+    const bus_recovery_state_t recovery_state = recovery->state;
+#endif
+    bus_recovery_handle_alerts(recovery, alerts);
+#if CONFIG_TWAI_TESTER_INCIDENT_LOG
+    if (alerts & TWAI_ALERT_BUS_OFF) {
+        incident_log_value(INCIDENT_BUS_OFF,
+                           tester_stats.bus_off.load(std::memory_order_relaxed));
+    }
+    if (recovery_state == BUS_RECOVERY_RECOVERING && recovery->state == BUS_RECOVERY_IDLE) {
+        incident_log_value(INCIDENT_RECOVERED, recovery->last_recovery_us);
+    }
+    if (alerts & TWAI_ALERT_RX_FIFO_OVERRUN) {
+        incident_log_value(INCIDENT_RX_OVERRUN, alerts);
+    }
+#endif
+#if CONFIG_TWAI_TESTER_HEALTH
+    controller_health_handle_alerts(&controller_health, alerts,
+                                    recovery->state == BUS_RECOVERY_IDLE);
+#endif
+}
+
+// Control task to check for errors and recover and restart the CAN-Bus when reaching a BUS_OFF
+// condition. As event loop it also fetches the received frames, so a single wait on the driver
+// alerts serves both.
+// Start the bus off handling and the health sampling over after the console restarted the driver.
+// A pending recovery ended with the restart, and a driver left bus off raises no new alert.
+static void _resync_driver(bus_recovery_t *recovery, const bus_recovery_config_t *config) {
+    bus_recovery_init(recovery, config, EXAMPLE_TAG);
+#if CONFIG_TWAI_TESTER_HEALTH
+    controller_health_resync(&controller_health);
+#endif
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) == ESP_OK && status.state == TWAI_STATE_BUS_OFF) {
+        bus_recovery_handle_alerts(recovery, TWAI_ALERT_BUS_OFF);
+    }
+}
+
+static void ctrl_task(void *arg) {
+    xSemaphoreTake(ctrl_task_sem, portMAX_DELAY);
+    ESP_ERROR_CHECK(twai_start());
+    ESP_LOGI(EXAMPLE_TAG, "Driver started");
+    ESP_LOGI(EXAMPLE_TAG, "Starting transmissions");
+    xSemaphoreGive(tx_task_sem);   // Start transmit task
+
+    twai_reconfigure_alerts(ALERTS_WAITED, NULL);
+
+    esp_err_t alertStatus;
+    uint32_t alerts;
+    uint32_t reported_counts[_alert_name_list_size] = {};
+    TickType_t last_report = xTaskGetTickCount();
+
+    const bus_recovery_config_t recovery_config = {
+        .holdoff_ms = CONFIG_TWAI_TESTER_RECOVERY_HOLDOFF_MS,
+        .max_holdoff_ms = CONFIG_TWAI_TESTER_RECOVERY_MAX_HOLDOFF_MS,
+        .backoff_reset_ms = CONFIG_TWAI_TESTER_RECOVERY_BACKOFF_RESET_MS};
+    bus_recovery_t recovery;
+    bus_recovery_init(&recovery, &recovery_config, EXAMPLE_TAG);
+    uint32_t driver_generation = driver_gate_generation();
+#if CONFIG_TWAI_TESTER_HEALTH
+    const controller_health_config_t health_config = {
+        .quarantine_ms = CONFIG_TWAI_TESTER_HEALTH_QUARANTINE_MS,
+        .sample_ms = CONFIG_TWAI_TESTER_HEALTH_SAMPLE_MS,
+        .counter_rise = CONFIG_TWAI_TESTER_HEALTH_COUNTER_RISE,
+#if CONFIG_TWAI_TESTER_HEALTH_RESET
+        .reset = true,
+        .reset_events = CONFIG_TWAI_TESTER_HEALTH_RESET_EVENTS,
+        .reset_holdoff_ms = CONFIG_TWAI_TESTER_HEALTH_RESET_HOLDOFF_MS,
+        .cost_window_ms = CONFIG_TWAI_TESTER_HEALTH_COST_WINDOW_MS,
+#else
+        .reset = false,
+        .reset_events = 0,
+        .reset_holdoff_ms = 0,
+        .cost_window_ms = 0,
+#endif
+    };
+    controller_health_init(&controller_health, &health_config, EXAMPLE_TAG);
+#endif
+#if CONFIG_TWAI_TESTER_RX_EVENT_LOOP
+    rx_frame_t *frame = _alloc_rx_frame();
+#endif
+
+    while (1) {
+        driver_gate_enter();
+        if (driver_gate_generation() != driver_generation) {
+            driver_generation = driver_gate_generation();
+            _resync_driver(&recovery, &recovery_config);
+        }
+        // Then check if there are can errors logged, but wake up in time to end a recovery
+        // holdoff or to print the alert summary, and leave the gate in time for the console
+        TickType_t next_report = last_report + pdMS_TO_TICKS(ALERT_REPORT_INTERVAL_MS);
+        TickType_t wait = next_report - xTaskGetTickCount();
+        if (wait > pdMS_TO_TICKS(ALERT_REPORT_INTERVAL_MS)) {
+            wait = 0;   // Report is overdue
+        }
+        TickType_t recovery_wait = bus_recovery_poll(&recovery);
+#if CONFIG_TWAI_TESTER_HEALTH
+        TickType_t health_wait =
+            controller_health_poll(&controller_health, recovery.state == BUS_RECOVERY_IDLE);
+        if (health_wait < recovery_wait) {
+            recovery_wait = health_wait;
+        }
+#endif
+        if (recovery_wait < wait) {
+            wait = recovery_wait;
+        }
+        if (wait > pdMS_TO_TICKS(DRIVER_GATE_MAX_HOLD_MS)) {
+            wait = pdMS_TO_TICKS(DRIVER_GATE_MAX_HOLD_MS);
+        }
+        alerts = 0;
+        alertStatus = twai_read_alerts(&alerts, wait);
+        if (alertStatus == ESP_ERR_INVALID_STATE) {
+            vTaskDelay(pdMS_TO_TICKS(10));   // Driver not installed yet
+        }
+
+#if CONFIG_TWAI_TESTER_RX_EVENT_LOOP
+        // All frames which raised RX_DATA since the last wakeup
+        while (_receive_pending(frame)) {
+            _hand_over_rx_batch(&frame);
+        }
+        alerts &= ALERTS_ENABLED;
+#endif
+        if (alertStatus == ESP_OK && alerts != 0) {
+            _handle_alerts(alerts, &recovery);
+        }
+
+        TickType_t now = xTaskGetTickCount();
+        if (now - last_report >= pdMS_TO_TICKS(ALERT_REPORT_INTERVAL_MS)) {
+            _print_alert_summary(reported_counts);
+            last_report = now;
+        }
+        driver_gate_leave();
+    }
+
+    xSemaphoreGive(ctrl_task_sem);
+    vTaskDelete(NULL);
+}
+
+// Install the TWAI driver from a task pinned to TWAI_ISR_CORE, as the driver allocates its
+// interrupt on the calling core.
+static void install_task(void *arg) {
+#if CONFIG_TWAI_TESTER_BENCH_SUITE
+    const bench_suite_config_t bench_config = {
+        .duration_ms = CONFIG_TWAI_TESTER_BENCH_SUITE_MS,
+#if CONFIG_TWAI_TESTER_BENCH_SUITE_ALL_BITRATES
+        .all_bitrates = true,
+#else
+        .all_bitrates = false,
+#endif
+        .bus_off_pulse_us = CONFIG_TWAI_TESTER_BENCH_SUITE_BUS_OFF_PULSE_US,
+        .bus_off_interval_ms = CONFIG_TWAI_TESTER_BENCH_SUITE_BUS_OFF_INTERVAL_MS};
+    benchmark_suite_run(&g_config, &bench_config, TAG);
+#endif
+#if CONFIG_TWAI_TESTER_FILTER_BENCHMARK
+    acceptance_filter_benchmark(&g_config, &t_config, &f_config,
+                                CONFIG_TWAI_TESTER_FILTER_BENCHMARK_MS, TAG);
+#endif
+#if CONFIG_TWAI_TESTER_QUEUE_BENCHMARK
+    const queue_bench_config_t queue_bench_config = {
+        .first_depth = CONFIG_TWAI_TESTER_QUEUE_BENCH_FIRST_DEPTH,
+        .last_depth = CONFIG_TWAI_TESTER_QUEUE_BENCH_LAST_DEPTH,
+        .rate = CONFIG_TWAI_TESTER_QUEUE_BENCH_RATE,
+        .burst_frames = CONFIG_TWAI_TESTER_QUEUE_BENCH_BURST_FRAMES,
+        .burst_interval_ms = CONFIG_TWAI_TESTER_QUEUE_BENCH_BURST_INTERVAL_MS,
+        .delay_us = CONFIG_TWAI_TESTER_QUEUE_BENCH_DELAY_US,
+        .duration_ms = CONFIG_TWAI_TESTER_QUEUE_BENCH_MS};
+    queue_depth_benchmark(&g_config, &t_config, &queue_bench_config, TAG);
+#endif
+#if CONFIG_TWAI_TESTER_DIAG_BENCHMARK
+    diag_log_benchmark(&g_config, &t_config, CONFIG_TWAI_TESTER_DIAG_BENCHMARK_MS, TAG);
+#endif
+    ESP_ERROR_CHECK(twai_driver_install(&g_config, &t_config, &f_config));
+#if CONFIG_TWAI_TESTER_PROFILER_ISR_PROBE
+    latency_profiler_isr_probe(CONFIG_TWAI_TESTER_PROFILER_ISR_PROBE_MS, TAG);
+#endif
+    xSemaphoreGive((SemaphoreHandle_t)arg);
+    vTaskDelete(NULL);
+}
 
 // Start Tasks and install drivers
 extern "C" void app_main(void) {
+    ESP_ERROR_CHECK(driver_gate_init());
     tx_task_sem = xSemaphoreCreateBinary();
     ctrl_task_sem = xSemaphoreCreateBinary();
 
-    xTaskCreatePinnedToCore(tx_task, "TWAI_tx", 4096, NULL, TX_TASK_PRIO, NULL, TX_TASK_PRIO % 2);
-    xTaskCreatePinnedToCore(rx_task, "TWAI_rx", 4096, NULL, TX_TASK_PRIO, NULL, TX_TASK_PRIO % 2);
-    xTaskCreatePinnedToCore(ctrl_task, "TWAI_ctrl", 4096, NULL, CTRL_TASK_PRIO, NULL,
-                            CTRL_TASK_PRIO % 2);
+#if CONFIG_TWAI_TESTER_INCIDENT_LOG
+    const incident_log_config_t incident_config = {
+        .batch_records = CONFIG_TWAI_TESTER_INCIDENT_LOG_BATCH,
+        .blocks = CONFIG_TWAI_TESTER_INCIDENT_LOG_BLOCKS,
+        .queue_len = CONFIG_TWAI_TESTER_INCIDENT_LOG_QUEUE_LEN,
+        .flush_interval_ms = CONFIG_TWAI_TESTER_INCIDENT_LOG_FLUSH_MS,
+        .min_write_interval_ms = CONFIG_TWAI_TESTER_INCIDENT_LOG_MIN_WRITE_MS,
+        .frames_per_minute = CONFIG_TWAI_TESTER_INCIDENT_LOG_FRAMES_PER_MIN,
+        .checkpoint_interval_ms = CONFIG_TWAI_TESTER_INCIDENT_LOG_CHECKPOINT_MS};
+#if CONFIG_TWAI_TESTER_INCIDENT_LOG_PRINT
+    const bool print_incidents = true;
+#else
+    const bool print_incidents = false;
+#endif
+    ESP_ERROR_CHECK(incident_log_start(&incident_config, print_incidents, TAG, ANALYSIS_TASK_CORE,
+                                       STATS_TASK_PRIO));
+#endif
+#if CONFIG_TWAI_TESTER_STREAM
+    ESP_ERROR_CHECK(frame_stream_start(ANALYSIS_TASK_CORE, ANALYSIS_TASK_PRIO));
+#endif
+#if CONFIG_TWAI_TESTER_UDP
+    ESP_ERROR_CHECK(udp_gateway_start(ANALYSIS_TASK_CORE, ANALYSIS_TASK_PRIO));
+#endif
+
+    xTaskCreatePinnedToCore(analysis_task, "TWAI_analysis", TASK_STACK_SIZE, NULL,
+                            ANALYSIS_TASK_PRIO, &analysis_task_handle, ANALYSIS_TASK_CORE);
+    xTaskCreatePinnedToCore(tx_task, "TWAI_tx", TASK_STACK_SIZE, NULL, TX_TASK_PRIO, NULL,
+                            TX_TASK_CORE);
+#if CONFIG_TWAI_TESTER_RX_EVENT_LOOP
+    // The control task is the receiver as well, so it takes the place of the RX task
+    xTaskCreatePinnedToCore(ctrl_task, "TWAI_events", TASK_STACK_SIZE, NULL, RX_TASK_PRIO, NULL,
+                            RX_TASK_CORE);
+#else
+    xTaskCreatePinnedToCore(rx_task, "TWAI_rx", TASK_STACK_SIZE, NULL, RX_TASK_PRIO, NULL,
+                            RX_TASK_CORE);
+    xTaskCreatePinnedToCore(ctrl_task, "TWAI_ctrl", TASK_STACK_SIZE, NULL, CTRL_TASK_PRIO, NULL,
+                            CTRL_TASK_CORE);
+#endif
 
     // Install TWAI driver
-    ESP_ERROR_CHECK(twai_driver_install(&g_config, &t_config, &f_config));
-    ESP_LOGI(EXAMPLE_TAG, "Driver installed");
+    SemaphoreHandle_t install_sem = xSemaphoreCreateBinary();
+    xTaskCreatePinnedToCore(install_task, "TWAI_install", 4096, install_sem, CTRL_TASK_PRIO,
+                            NULL, TWAI_ISR_CORE);
+    xSemaphoreTake(install_sem, portMAX_DELAY);
+    vSemaphoreDelete(install_sem);
+    ESP_LOGI(EXAMPLE_TAG, "Driver installed (ISR on core %d)", TWAI_ISR_CORE);
+    uint32_t sample_point = twai_timing_sample_point_permille(&t_config);
+    ESP_LOGI(EXAMPLE_TAG, "Bitrate: %lu bit/s, sample point: %lu.%lu%%, sjw: %u",
+             twai_timing_bitrate(&t_config), sample_point / 10, sample_point % 10, t_config.sjw);
+    ESP_LOGI(EXAMPLE_TAG, "Filter: %s, code: 0x%08lx, mask: 0x%08lx",
+             f_config.single_filter ? "single" : "dual", f_config.acceptance_code,
+             f_config.acceptance_mask);
+
+    ESP_ERROR_CHECK(tester_stats_start_reporter(TAG, RX_REPORT_INTERVAL_MS, ANALYSIS_TASK_CORE,
+                                                STATS_TASK_PRIO));
+
+#if CONFIG_TWAI_TESTER_TASK_MONITOR
+    const task_monitor_config_t monitor_config = {
+        .interval_ms = CONFIG_TWAI_TESTER_TASK_MONITOR_INTERVAL_MS,
+        .name_prefix = "TWAI",
+        .stack_warn_bytes = CONFIG_TWAI_TESTER_TASK_MONITOR_STACK_WARN};
+    ESP_ERROR_CHECK(task_monitor_start(&monitor_config, TAG, ANALYSIS_TASK_CORE, STATS_TASK_PRIO));
+#endif
+
+#if CONFIG_TWAI_TESTER_FAULT_INJECTION
+    const fault_inject_config_t fault_config = {
+#if CONFIG_TWAI_TESTER_FAULT_TX_INVERT
+        .mode = FAULT_INJECT_TX_INVERT,
+#else
+        .mode = FAULT_INJECT_RX_INVERT,
+#endif
+        .tx_gpio = TX_GPIO_NUM,
+        .rx_gpio = RX_GPIO_NUM,
+        .duration_us = CONFIG_TWAI_TESTER_FAULT_DURATION_US,
+        .interval_us = CONFIG_TWAI_TESTER_FAULT_INTERVAL_MS * 1000,
+        .counter = &tester_stats.fault_injections};
+    ESP_ERROR_CHECK(fault_injection_start(&fault_config));
+#endif
+
+#if CONFIG_TWAI_TESTER_SECOND_CONTROLLER
+    const second_controller_config_t second_config = {
+#if CONFIG_TWAI_TESTER_SECOND_ROLE_LOAD
+        .role = SECOND_CONTROLLER_LOAD,
+#else
+        .role = SECOND_CONTROLLER_GATEWAY,
+#endif
+        .tx_gpio = SECOND_TX_GPIO_NUM,
+        .rx_gpio = SECOND_RX_GPIO_NUM,
+        .tx_queue_len = TX_QUEUE_LEN,
+        .rx_queue_len = RX_QUEUE_LEN,
+#if CONFIG_TWAI_TESTER_SECOND_ROLE_LOAD
+        .probe_id = LOOPBACK_PROBE_ID,
+        .probe_period_ms = CONFIG_TWAI_TESTER_SECOND_PROBE_PERIOD_MS,
+#else
+        .probe_id = 0,
+        .probe_period_ms = 0,
+#endif
+        .core = CONFIG_TWAI_TESTER_SECOND_TASK_CORE,
+        .priority = CONFIG_TWAI_TESTER_SECOND_TASK_PRIO};
+    ESP_ERROR_CHECK(second_controller_start(&t_config, &second_config, RX_REPORT_INTERVAL_MS, TAG));
+    ESP_LOGI(EXAMPLE_TAG, "Controller 1 started (core %d)", second_config.core);
+#endif
 
     xSemaphoreGive(ctrl_task_sem);   // Start control task
     vTaskDelay(pdMS_TO_TICKS(100));
 
+#if CONFIG_TWAI_TESTER_CONSOLE
+    const tester_console_config_t console_config = {.g_config = g_config,
+                                                    .t_config = t_config,
+                                                    .f_config = f_config,
+                                                    .isr_core = TWAI_ISR_CORE,
+                                                    .load_core = TX_TASK_CORE,
+                                                    .load_priority = TX_TASK_PRIO};
+    ESP_ERROR_CHECK(tester_console_start(&console_config, TAG));
+#endif
+
     // Never get this semaphore...
     xSemaphoreTake(ctrl_task_sem, portMAX_DELAY);   // Wait for completion
 
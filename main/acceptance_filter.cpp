@@ -0,0 +1,189 @@
+#include "acceptance_filter.h"
+
+#include "cpu_usage.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "expected_frames.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// The filter only sees ID[28:13] of extended frames in dual filter mode
+#define DUAL_EXTD_ID_SHIFT 13
+
+// Code and don't care bits of a group of IDs: Bits which differ within the group are don't care
+typedef struct {
+    uint32_t code;
+    uint32_t dont_care;
+} id_group_t;
+
+static id_group_t _id_group(const uint32_t *ids, size_t count) {
+    id_group_t group = {.code = ids[0], .dont_care = 0};
+    for (size_t i = 1; i < count; ++i) {
+        group.dont_care |= ids[i] ^ ids[0];
+    }
+    return group;
+}
+
+// Number of IDs a group accepts
+static uint32_t _id_group_size(const id_group_t *group) {
+    return 1u << __builtin_popcount(group->dont_care);
+}
+
+static void _sort_ids(uint32_t *ids, size_t count) {
+    for (size_t i = 1; i < count; ++i) {
+        uint32_t id = ids[i];
+        size_t j = i;
+        for (; j > 0 && ids[j - 1] > id; --j) {
+            ids[j] = ids[j - 1];
+        }
+        ids[j] = id;
+    }
+}
+
+twai_filter_config_t acceptance_filter_from_table(acceptance_filter_mode_t mode) {
+    const twai_filter_config_t accept_all = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    const size_t count = expected_frame_count();
+    if (mode == ACCEPTANCE_FILTER_ALL || count == 0) {
+        return accept_all;
+    }
+
+    const bool extd = expected_frame_at(0)->extd;
+    uint32_t ids[EXPECTED_FRAMES_MAX];
+    for (size_t i = 0; i < count; ++i) {
+        const expected_frame_t *expected = expected_frame_at(i);
+        if (expected->extd != extd) {
+            return accept_all;
+        }
+        ids[i] = expected->identifier;
+    }
+
+    twai_filter_config_t filter = {};
+    if (mode == ACCEPTANCE_FILTER_SINGLE) {
+        id_group_t group = _id_group(ids, count);
+        filter.single_filter = true;
+        if (extd) {
+            // ID[28:0] in bits 31..3, RTR in bit 2
+            filter.acceptance_code = group.code << 3;
+            filter.acceptance_mask = (group.dont_care << 3) | 0x7;
+        } else {
+            // ID[10:0] in bits 31..21, RTR in bit 20, bits 19..16 unused, data bytes 1 and 2 in
+            // bits 15..0
+            filter.acceptance_code = group.code << 21;
+            filter.acceptance_mask = (group.dont_care << 21) | 0x1FFFFF;
+        }
+    } else {
+        if (extd) {
+            for (size_t i = 0; i < count; ++i) {
+                ids[i] >>= DUAL_EXTD_ID_SHIFT;
+            }
+        }
+        // Split the sorted IDs at the position where both groups together accept the fewest IDs
+        _sort_ids(ids, count);
+        id_group_t first = _id_group(ids, count);
+        id_group_t second = first;
+        uint32_t best = 2 * _id_group_size(&first);
+        for (size_t split = 1; split < count; ++split) {
+            id_group_t a = _id_group(ids, split);
+            id_group_t b = _id_group(&ids[split], count - split);
+            uint32_t size = _id_group_size(&a) + _id_group_size(&b);
+            if (size < best) {
+                best = size;
+                first = a;
+                second = b;
+            }
+        }
+        filter.single_filter = false;
+        if (extd) {
+            // Filter 1: ID[28:13] in bits 31..16, filter 2: ID[28:13] in bits 15..0
+            filter.acceptance_code = (first.code << 16) | (second.code & 0xFFFF);
+            filter.acceptance_mask = (first.dont_care << 16) | (second.dont_care & 0xFFFF);
+        } else {
+            // Filter 1: ID in bits 31..21, RTR in bit 20, data byte 1 in bits 19..16 and 3..0
+            // Filter 2: ID in bits 15..5, RTR in bit 4
+            filter.acceptance_code = (first.code << 21) | (second.code << 5);
+            filter.acceptance_mask = (first.dont_care << 21) | (second.dont_care << 5) | 0x1F001F;
+        }
+    }
+    return filter;
+}
+
+typedef struct {
+    uint32_t frames;
+    uint32_t rx_missed;
+    uint32_t busy_permille[portNUM_PROCESSORS];
+} filter_bench_result_t;
+
+// Install the driver with filter and receive for duration_ms like the RX task would
+static esp_err_t _bench_run(const twai_general_config_t *g_config,
+                            const twai_timing_config_t *t_config,
+                            const twai_filter_config_t *filter, uint32_t duration_ms,
+                            filter_bench_result_t *result) {
+    esp_err_t res = twai_driver_install(g_config, t_config, filter);
+    if (res != ESP_OK) {
+        return res;
+    }
+    res = twai_start();
+    if (res != ESP_OK) {
+        twai_driver_uninstall();
+        return res;
+    }
+
+    *result = {};
+    cpu_usage_sample_t start, end;
+    cpu_usage_sample(&start);
+    const int64_t end_us = esp_timer_get_time() + duration_ms * 1000LL;
+    twai_message_t message;
+    while (esp_timer_get_time() < end_us) {
+        if (twai_receive(&message, pdMS_TO_TICKS(10)) == ESP_OK) {
+            result->frames++;
+        }
+    }
+    cpu_usage_sample(&end);
+
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) == ESP_OK) {
+        result->rx_missed = status.rx_missed_count;
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+        result->busy_permille[core] = cpu_usage_busy_permille(&start, &end, core);
+    }
+
+    twai_stop();
+    return twai_driver_uninstall();
+}
+
+static void _bench_print(const char *tag, const char *name, const filter_bench_result_t *result) {
+    for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+        ESP_LOGI(tag, "Filter bench %s: frames: %lu, rx missed: %lu, core %d load: %lu.%lu%%", name,
+                 result->frames, result->rx_missed, core, result->busy_permille[core] / 10,
+                 result->busy_permille[core] % 10);
+    }
+}
+
+void acceptance_filter_benchmark(const twai_general_config_t *g_config,
+                                 const twai_timing_config_t *t_config,
+                                 const twai_filter_config_t *filter, uint32_t duration_ms,
+                                 const char *tag) {
+    const twai_filter_config_t accept_all = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    filter_bench_result_t all, filtered;
+
+    ESP_LOGI(tag, "Filter bench: %lu ms per run on core %d", duration_ms, xPortGetCoreID());
+    esp_err_t res = _bench_run(g_config, t_config, &accept_all, duration_ms, &all);
+    if (res == ESP_OK) {
+        res = _bench_run(g_config, t_config, filter, duration_ms, &filtered);
+    }
+    if (res != ESP_OK) {
+        ESP_LOGW(tag, "Filter bench failed: %s", esp_err_to_name(res));
+        return;
+    }
+
+    _bench_print(tag, "accept all", &all);
+    _bench_print(tag, "filtered", &filtered);
+    ESP_LOGI(tag, "Filter bench: frames dropped in hardware: %lu",
+             all.frames > filtered.frames ? all.frames - filtered.frames : 0);
+    for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+        ESP_LOGI(tag, "Filter bench: core %d load: %lu.%lu%% -> %lu.%lu%%", core,
+                 all.busy_permille[core] / 10, all.busy_permille[core] % 10,
+                 filtered.busy_permille[core] / 10, filtered.busy_permille[core] % 10);
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/twai.h"
+
+typedef enum {
+    ACCEPTANCE_FILTER_ALL,      // Accept every frame
+    ACCEPTANCE_FILTER_SINGLE,   // One code/mask pair covering all expected IDs
+    ACCEPTANCE_FILTER_DUAL,     // Expected IDs split onto the two filters of dual filter mode
+} acceptance_filter_mode_t;
+
+// Compute the hardware acceptance filter for the IDs of the expected frame table. The filters
+// only compare IDs, so they may let through some frames which are not in the table. Falls back to
+// accepting all frames if the table mixes standard and extended IDs.
+twai_filter_config_t acceptance_filter_from_table(acceptance_filter_mode_t mode);
+
+// Receive for duration_ms once accepting all frames and once with filter, and print the frame
+// counts and CPU load of each core for both runs. Must be called while the driver is not
+// installed, the driver interrupt is allocated on the calling core.
+void acceptance_filter_benchmark(const twai_general_config_t *g_config,
+                                 const twai_timing_config_t *t_config,
+                                 const twai_filter_config_t *filter, uint32_t duration_ms,
+                                 const char *tag);
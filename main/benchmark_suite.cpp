@@ -0,0 +1,271 @@
+#include "benchmark_suite.h"
+
+#include "bus_load.h"
+#include "cpu_usage.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "fault_injection.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "jitter_histogram.h"
+#include "loopback_frame.h"
+#include "sdkconfig.h"
+#include "self_rx_bench.h"
+
+#define BENCH_ALERTS (TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED)
+#define BENCH_SETTLE_MS 1000   // Max. wait for the last recovery after the bus off scenario
+
+typedef struct {
+    const char *name;
+    uint32_t load_percent;   // Bus load generated by the own frames, 0 for an idle bus
+    bool bus_off;            // Drive the node bus off periodically
+} bench_scenario_t;
+
+static const bench_scenario_t bench_scenarios[] = {
+    {.name = "idle", .load_percent = 0, .bus_off = false},
+    {.name = "load50", .load_percent = 50, .bus_off = false},
+    {.name = "load90", .load_percent = 90, .bus_off = false},
+    {.name = "busoff", .load_percent = 50, .bus_off = true},
+};
+
+typedef struct {
+    twai_timing_config_t timing;
+    bool standard;   // Part of the short bitrate list
+} bench_bitrate_t;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+static const bench_bitrate_t bench_bitrates[] = {
+    {.timing = TWAI_TIMING_CONFIG_25KBITS(), .standard = false},
+    {.timing = TWAI_TIMING_CONFIG_50KBITS(), .standard = false},
+    {.timing = TWAI_TIMING_CONFIG_100KBITS(), .standard = false},
+    {.timing = TWAI_TIMING_CONFIG_125KBITS(), .standard = true},
+    {.timing = TWAI_TIMING_CONFIG_250KBITS(), .standard = true},
+    {.timing = TWAI_TIMING_CONFIG_500KBITS(), .standard = true},
+    {.timing = TWAI_TIMING_CONFIG_800KBITS(), .standard = false},
+    {.timing = TWAI_TIMING_CONFIG_1MBITS(), .standard = true},
+};
+#pragma GCC diagnostic pop
+
+typedef struct {
+    uint32_t elapsed_ms;   // Measured time, longer than the duration if a recovery was awaited
+    uint32_t sent;
+    uint32_t tx_rejected;   // Frames not queued, TX queue full or bus off
+    uint32_t received;
+    uint32_t lost;          // Gaps in the sequence numbers
+    uint32_t rx_missed;
+    uint32_t rx_overrun;
+    uint32_t tx_failed;
+    uint32_t bus_errors;
+    uint32_t bus_off;
+    uint32_t max_recovery_ms;   // Longest time from bus off until the restart
+    uint32_t cpu_permille[portNUM_PROCESSORS];
+    uint32_t rx_task_permille;   // Calling task, which receives
+    uint32_t tx_task_permille;   // esp_timer task, which transmits and injects the faults
+} bench_result_t;
+
+// Receive state of a run, only accessed by the calling task
+typedef struct {
+    const twai_general_config_t *g_config;
+    const bench_suite_config_t *config;
+    const bench_scenario_t *scenario;
+    bench_result_t *result;
+    TaskHandle_t tx_task;
+    cpu_usage_sample_t cpu_start;
+    uint32_t rx_task_start;
+    uint32_t tx_task_start;
+    int64_t bus_off_us;
+} bench_state_t;
+
+static JitterHistogram<20, 1000> bench_latency;   // From twai_transmit() to the dequeue
+static loopback_sequence_t bench_sequence;
+
+static bool _bench_tx(twai_message_t *message, uint32_t sent, void *arg) {
+    loopback_frame_stamp(message, sent);
+    return true;
+}
+
+static void _bench_frame(const twai_message_t *message, void *arg) {
+    bench_latency.add(loopback_frame_latency_us(message, esp_timer_get_time()));
+    loopback_sequence_record(&bench_sequence, loopback_frame_sequence(message));
+}
+
+// Handle the bus off alerts
+static void _bench_poll(void *arg) {
+    bench_state_t *state = (bench_state_t *)arg;
+    uint32_t alerts = 0;
+    if (twai_read_alerts(&alerts, 0) != ESP_OK) {
+        return;
+    }
+    if (alerts & TWAI_ALERT_BUS_OFF) {
+        state->result->bus_off++;
+        state->bus_off_us = esp_timer_get_time();
+        twai_initiate_recovery();
+    }
+    if (alerts & TWAI_ALERT_BUS_RECOVERED) {
+        twai_start();
+        const uint32_t recovery_ms = (esp_timer_get_time() - state->bus_off_us) / 1000;
+        if (recovery_ms > state->result->max_recovery_ms) {
+            state->result->max_recovery_ms = recovery_ms;
+        }
+    }
+}
+
+static esp_err_t _bench_start(void *arg) {
+    bench_state_t *state = (bench_state_t *)arg;
+    state->tx_task = xTaskGetHandle("esp_timer");
+    cpu_usage_sample(&state->cpu_start);
+    state->rx_task_start = cpu_usage_task_counter(xTaskGetCurrentTaskHandle());
+    state->tx_task_start = cpu_usage_task_counter(state->tx_task);
+    if (!state->scenario->bus_off) {
+        return ESP_OK;
+    }
+    const fault_inject_config_t fault_config = {.mode = FAULT_INJECT_TX_INVERT,
+                                                .tx_gpio = state->g_config->tx_io,
+                                                .rx_gpio = state->g_config->rx_io,
+                                                .duration_us = state->config->bus_off_pulse_us,
+                                                .interval_us =
+                                                    state->config->bus_off_interval_ms * 1000,
+                                                .counter = NULL};   // No fault injection run
+    return fault_injection_start(&fault_config);
+}
+
+// The CPU figures cover the receive time without the recovery wait
+static void _bench_stop(void *arg) {
+    bench_state_t *state = (bench_state_t *)arg;
+    bench_result_t *result = state->result;
+    cpu_usage_sample_t cpu_end;
+    cpu_usage_sample(&cpu_end);
+    result->rx_task_permille =
+        cpu_usage_task_permille(&state->cpu_start, &cpu_end, state->rx_task_start,
+                                cpu_usage_task_counter(xTaskGetCurrentTaskHandle()));
+    result->tx_task_permille =
+        cpu_usage_task_permille(&state->cpu_start, &cpu_end, state->tx_task_start,
+                                cpu_usage_task_counter(state->tx_task));
+    for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+        result->cpu_permille[core] = cpu_usage_busy_permille(&state->cpu_start, &cpu_end, core);
+    }
+    if (state->scenario->bus_off) {
+        fault_injection_stop();
+    }
+}
+
+static esp_err_t _bench_run(const twai_general_config_t *g_config,
+                            const twai_timing_config_t *t_config,
+                            const bench_suite_config_t *config, const bench_scenario_t *scenario,
+                            bench_result_t *result) {
+    *result = {};
+    bench_latency.reset();
+    bench_sequence = {};
+    bench_state_t state = {};
+    state.g_config = g_config;
+    state.config = config;
+    state.scenario = scenario;
+    state.result = result;
+
+    uint32_t period_us = 0;
+    if (scenario->load_percent != 0) {
+        twai_message_t frame = {};
+        frame.data_length_code = LOOPBACK_FRAME_DLC;
+        const uint32_t rate = (uint64_t)twai_max_frame_rate(twai_timing_bitrate(t_config),
+                                                            twai_frame_bits(&frame, false)) *
+                              scenario->load_percent / 100;
+        period_us = 1000000 / rate;
+    }
+    const uint32_t settle_ms = scenario->bus_off ? BENCH_SETTLE_MS : 0;
+    const self_rx_bench_config_t bench = {.name = "bench_tx",
+                                          .rx_queue_len = 0,
+                                          .alerts_enabled = BENCH_ALERTS,
+                                          .data_length_code = LOOPBACK_FRAME_DLC,
+                                          .period_us = period_us,
+                                          .duration_ms = config->duration_ms,
+                                          .settle_ms = settle_ms,
+                                          .on_tx = _bench_tx,
+                                          .on_frame = _bench_frame,
+                                          .on_poll = _bench_poll,
+                                          .on_start = _bench_start,
+                                          .on_stop = _bench_stop,
+                                          .arg = &state};
+    self_rx_bench_result_t bench_result;
+    esp_err_t res = self_rx_bench_run(g_config, t_config, &bench, &bench_result);
+    result->elapsed_ms = bench_result.elapsed_us / 1000;
+    result->sent = bench_result.sent;
+    result->tx_rejected = bench_result.tx_rejected;
+    result->received = bench_sequence.received;
+    result->lost = bench_sequence.lost;
+    result->rx_missed = bench_result.status.rx_missed_count;
+    result->rx_overrun = bench_result.status.rx_overrun_count;
+    result->tx_failed = bench_result.status.tx_failed_count;
+    result->bus_errors = bench_result.status.bus_error_count;
+    return res;
+}
+
+static void _print_info(const bench_suite_config_t *config, const char *tag) {
+    ESP_LOGI(tag,
+             "BENCH_INFO,idf=%s,errata_bus_off_rec=%d,errata_tx_intr_lost=%d,"
+             "errata_rx_frame_invalid=%d,errata_rx_fifo_corrupt=%d,duration_ms=%lu",
+             esp_get_idf_version(),
+#if CONFIG_TWAI_ERRATA_FIX_BUS_OFF_REC
+             1,
+#else
+             0,
+#endif
+#if CONFIG_TWAI_ERRATA_FIX_TX_INTR_LOST
+             1,
+#else
+             0,
+#endif
+#if CONFIG_TWAI_ERRATA_FIX_RX_FRAME_INVALID
+             1,
+#else
+             0,
+#endif
+#if CONFIG_TWAI_ERRATA_FIX_RX_FIFO_CORRUPT
+             1,
+#else
+             0,
+#endif
+             config->duration_ms);
+    ESP_LOGI(tag,
+             "BENCH,scenario,bitrate,load_pct,sent,tx_rejected,received,frames_per_s,lost,"
+             "rx_missed,rx_overrun,tx_failed,bus_errors,bus_off,max_recovery_ms,lat_p50_us,"
+             "lat_p99_us,lat_max_us,cpu0_permille,cpu1_permille,rx_task_permille,"
+             "tx_task_permille");
+}
+
+static void _print_result(const bench_scenario_t *scenario, uint32_t bitrate,
+                          const bench_result_t *result, const char *tag) {
+    ESP_LOGI(tag,
+             "BENCH,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,"
+             "%lu,%lu",
+             scenario->name, bitrate, scenario->load_percent, result->sent, result->tx_rejected,
+             result->received, (uint32_t)((uint64_t)result->received * 1000 / result->elapsed_ms),
+             result->lost, result->rx_missed, result->rx_overrun, result->tx_failed,
+             result->bus_errors, result->bus_off, result->max_recovery_ms,
+             bench_latency.percentile_us(500), bench_latency.percentile_us(990),
+             bench_latency.max_us(), result->cpu_permille[0],
+             portNUM_PROCESSORS > 1 ? result->cpu_permille[portNUM_PROCESSORS - 1] : 0,
+             result->rx_task_permille, result->tx_task_permille);
+}
+
+void benchmark_suite_run(const twai_general_config_t *g_config, const bench_suite_config_t *config,
+                         const char *tag) {
+    _print_info(config, tag);
+    for (const bench_bitrate_t &bitrate : bench_bitrates) {
+        if (!config->all_bitrates && !bitrate.standard) {
+            continue;
+        }
+        for (const bench_scenario_t &scenario : bench_scenarios) {
+            bench_result_t result;
+            esp_err_t res = _bench_run(g_config, &bitrate.timing, config, &scenario, &result);
+            if (res != ESP_OK) {
+                ESP_LOGW(tag, "Benchmark %s at %lu bit/s failed: %s", scenario.name,
+                         twai_timing_bitrate(&bitrate.timing), esp_err_to_name(res));
+                return;
+            }
+            _print_result(&scenario, twai_timing_bitrate(&bitrate.timing), &result, tag);
+        }
+    }
+    ESP_LOGI(tag, "BENCH_DONE");
+}
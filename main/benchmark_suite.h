@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/twai.h"
+
+// Parameters of the benchmark suite
+typedef struct {
+    uint32_t duration_ms;           // Duration of each scenario run
+    bool all_bitrates;              // Run every standard bitrate instead of 125k to 1M
+    uint32_t bus_off_pulse_us;      // Length of the TX inversion which drives the node bus off
+    uint32_t bus_off_interval_ms;   // Mean time between two bus off pulses
+} bench_suite_config_t;
+
+// Run the standard scenarios (idle bus, 50 % and 90 % bus load, 50 % load with periodic bus off)
+// at each bitrate. Each run installs the driver in no-ACK mode and receives its own frames, which
+// carry their TX time and a sequence number for the latency and loss figures. Prints one
+// comma separated BENCH line per run after a BENCH_INFO line with the ESP-IDF version and the
+// TWAI errata settings, see tools/twai_bench_compare.py. As the queue benchmark, it needs a
+// transceiver or a TX-RX jumper and the frames are visible to other nodes on the bus.
+// Must be called while the driver is not installed.
+void benchmark_suite_run(const twai_general_config_t *g_config, const bench_suite_config_t *config,
+                         const char *tag);
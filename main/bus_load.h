@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/twai.h"
+
+// Frequency of TWAI_CLK_SRC_DEFAULT (APB) on the ESP32
+#define TWAI_SOURCE_CLOCK_HZ 80000000
+
+// Time quantum frequency of a timing configuration, either given directly or by the prescaler
+static inline uint32_t twai_timing_quanta_hz(const twai_timing_config_t *timing) {
+    if (timing->quanta_resolution_hz != 0) {
+        return timing->quanta_resolution_hz;
+    }
+    return timing->brp != 0 ? TWAI_SOURCE_CLOCK_HZ / timing->brp : 0;
+}
+
+// Nominal bitrate of a timing configuration
+static inline uint32_t twai_timing_bitrate(const twai_timing_config_t *timing) {
+    return twai_timing_quanta_hz(timing) / (1 + timing->tseg_1 + timing->tseg_2);
+}
+
+// Sample point of a timing configuration in 1/10 percent of the bit time
+static inline uint32_t twai_timing_sample_point_permille(const twai_timing_config_t *timing) {
+    return 1000 * (1 + timing->tseg_1) / (1 + timing->tseg_1 + timing->tseg_2);
+}
+
+// Number of bits a data frame occupies on the bus including the 3 bit interframe space. With
+// worst_case_stuffing the maximum number of stuff bits is added, otherwise none.
+static inline uint32_t twai_frame_bits(const twai_message_t *message, bool worst_case_stuffing) {
+    const uint32_t dlc = message->data_length_code > TWAI_FRAME_MAX_DLC
+                             ? TWAI_FRAME_MAX_DLC
+                             : message->data_length_code;
+    const uint32_t data_bits = message->rtr ? 0 : 8 * dlc;
+    // Bits from SOF to CRC sequence are subject to bit stuffing
+    const uint32_t stuffed_bits = (message->extd ? 54 : 34) + data_bits;
+    const uint32_t stuff_bits = worst_case_stuffing ? (stuffed_bits - 1) / 4 : 0;
+    // CRC delimiter, ACK slot, ACK delimiter, EOF and interframe space
+    return stuffed_bits + stuff_bits + 1 + 2 + 7 + 3;
+}
+
+// Theoretical maximum number of back to back frames per second
+static inline uint32_t twai_max_frame_rate(uint32_t bitrate, uint32_t frame_bits) {
+    return frame_bits != 0 ? bitrate / frame_bits : 0;
+}
+
+// Arbitration priority of a frame, lower values win. The base ID is sent first, then a standard
+// frame wins against an extended one with the same base ID, and a data frame against a remote
+// frame with the same ID.
+static inline uint32_t twai_arbitration_key(const twai_message_t *message) {
+    const uint32_t base_id = message->extd ? message->identifier >> 18 : message->identifier;
+    const uint32_t extension = message->extd ? message->identifier & 0x3FFFF : 0;
+    return (base_id & TWAI_STD_ID_MASK) << 20 | (uint32_t)message->extd << 19 | extension << 1 |
+           message->rtr;
+}
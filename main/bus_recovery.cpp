@@ -0,0 +1,104 @@
+#include "bus_recovery.h"
+
+#include "driver/twai.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define RECOVERY_RETRY_US (100 * 1000)
+#define RECOVERY_MIN_BACKOFF_MS 10   // Base of the backoff with a shorter holdoff, e.g. 0
+
+// The first bus off waits the configured holdoff, each further one in a row twice as long as
+// the previous one
+static uint32_t _holdoff_ms(const bus_recovery_t *recovery) {
+    uint64_t holdoff_ms = recovery->config.holdoff_ms;
+    if (recovery->consecutive > 1 && holdoff_ms < RECOVERY_MIN_BACKOFF_MS) {
+        holdoff_ms = RECOVERY_MIN_BACKOFF_MS;
+    }
+    for (uint32_t i = 1; i < recovery->consecutive && holdoff_ms < recovery->config.max_holdoff_ms;
+         ++i) {
+        holdoff_ms *= 2;
+    }
+    if (holdoff_ms > recovery->config.max_holdoff_ms) {
+        holdoff_ms = recovery->config.max_holdoff_ms;
+    }
+    return holdoff_ms;
+}
+
+static void _initiate_recovery(bus_recovery_t *recovery) {
+    esp_err_t res = twai_initiate_recovery();   // Needs 128 occurrences of bus free signal
+    if (res != ESP_OK) {
+        // Try again a bit later instead of waiting for a BUS_RECOVERED which never comes
+        ESP_LOGW(recovery->tag, "Could not initiate bus recovery: %s", esp_err_to_name(res));
+        recovery->deadline_us = esp_timer_get_time() + RECOVERY_RETRY_US;
+        recovery->state = BUS_RECOVERY_HOLDOFF;
+        return;
+    }
+    ESP_LOGI(recovery->tag, "Initiate bus recovery");
+    recovery->state = BUS_RECOVERY_RECOVERING;
+}
+
+void bus_recovery_init(bus_recovery_t *recovery, const bus_recovery_config_t *config,
+                       const char *tag) {
+    *recovery = {};
+    recovery->config = *config;
+    recovery->tag = tag;
+}
+
+void bus_recovery_handle_alerts(bus_recovery_t *recovery, uint32_t alerts) {
+    const int64_t now_us = esp_timer_get_time();
+
+    if ((alerts & TWAI_ALERT_BUS_OFF) && recovery->state == BUS_RECOVERY_IDLE) {
+        if (recovery->recovered_us != 0 &&
+            now_us - recovery->recovered_us > recovery->config.backoff_reset_ms * 1000LL) {
+            recovery->consecutive = 0;
+        }
+        recovery->consecutive++;
+        recovery->incidents++;
+        recovery->bus_off_us = now_us;
+
+        uint32_t holdoff_ms = _holdoff_ms(recovery);
+        ESP_LOGI(recovery->tag, "Bus Off state (#%lu, %lu in a row), recovery in %lu ms",
+                 recovery->incidents, recovery->consecutive, holdoff_ms);
+        if (holdoff_ms == 0) {
+            _initiate_recovery(recovery);
+        } else {
+            recovery->deadline_us = now_us + holdoff_ms * 1000LL;
+            recovery->state = BUS_RECOVERY_HOLDOFF;
+        }
+    }
+
+    if ((alerts & TWAI_ALERT_BUS_RECOVERED) && recovery->state == BUS_RECOVERY_RECOVERING) {
+        ESP_LOGI(recovery->tag, "Bus Recovered");
+        esp_err_t res = twai_start();
+        if (res != ESP_OK) {
+            ESP_LOGE(recovery->tag, "Could not start driver again: %s", esp_err_to_name(res));
+        }
+
+        const int64_t started_us = esp_timer_get_time();
+        recovery->last_recovery_us = started_us - recovery->bus_off_us;
+        recovery->total_recovery_us += recovery->last_recovery_us;
+        if (recovery->last_recovery_us > recovery->max_recovery_us) {
+            recovery->max_recovery_us = recovery->last_recovery_us;
+        }
+        recovery->recovered_us = started_us;
+        recovery->state = BUS_RECOVERY_IDLE;
+        ESP_LOGI(recovery->tag,
+                 "Driver started again after %lu us (max: %lu us, mean: %lu us over %lu)",
+                 recovery->last_recovery_us, recovery->max_recovery_us,
+                 (uint32_t)(recovery->total_recovery_us / recovery->incidents),
+                 recovery->incidents);
+    }
+}
+
+TickType_t bus_recovery_poll(bus_recovery_t *recovery) {
+    if (recovery->state != BUS_RECOVERY_HOLDOFF) {
+        return portMAX_DELAY;
+    }
+    const int64_t remaining_us = recovery->deadline_us - esp_timer_get_time();
+    if (remaining_us <= 0) {
+        _initiate_recovery(recovery);
+        return portMAX_DELAY;
+    }
+    // Round up, so the holdoff is not cut short by the tick resolution
+    return pdMS_TO_TICKS((remaining_us + 999) / 1000) + 1;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+typedef enum {
+    BUS_RECOVERY_IDLE,         // Bus running
+    BUS_RECOVERY_HOLDOFF,      // Bus off, waiting for the holdoff to expire
+    BUS_RECOVERY_RECOVERING,   // Recovery initiated, waiting for BUS_RECOVERED
+} bus_recovery_state_t;
+
+typedef struct {
+    uint32_t holdoff_ms;         // Delay between bus off and recovery, 0 to recover at once
+    uint32_t max_holdoff_ms;     // Upper limit of the exponential backoff
+    uint32_t backoff_reset_ms;   // Stable bus time after which the backoff starts over
+} bus_recovery_config_t;
+
+// Event driven bus-off recovery. The state machine never blocks, the owner feeds it with the
+// alerts read from the driver and waits for the next alert at most bus_recovery_poll() ticks.
+typedef struct {
+    bus_recovery_config_t config;
+    const char *tag;
+    bus_recovery_state_t state;
+    uint32_t consecutive;   // Bus-offs without a stable bus phase in between
+    int64_t bus_off_us;     // esp_timer time of the current bus off
+    int64_t deadline_us;    // End of the holdoff
+    int64_t recovered_us;   // esp_timer time of the last completed recovery
+    uint32_t incidents;
+    uint32_t last_recovery_us;   // Time from bus off until the driver was started again
+    uint32_t max_recovery_us;
+    uint64_t total_recovery_us;
+} bus_recovery_t;
+
+void bus_recovery_init(bus_recovery_t *recovery, const bus_recovery_config_t *config,
+                       const char *tag);
+
+// Advance the state machine with the alerts returned by twai_read_alerts()
+void bus_recovery_handle_alerts(bus_recovery_t *recovery, uint32_t alerts);
+
+// Initiate the recovery if the holdoff expired and return the maximum number of ticks to wait
+// for the next alert
+TickType_t bus_recovery_poll(bus_recovery_t *recovery);
@@ -0,0 +1,192 @@
+#include "controller_health.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "incident_log.h"
+#include "sdkconfig.h"
+#include "tester_stats.h"
+
+#define BASELINE_US (1000 * 1000)
+
+// Frames which reached the analysis task, counted or quarantined
+static uint32_t _received_frames(void) {
+    const std::memory_order order = std::memory_order_relaxed;
+    return tester_stats.frames_ok.load(order) + tester_stats.frames_dlc_error.load(order) +
+           tester_stats.frames_data_error.load(order) +
+           tester_stats.frames_unknown_id.load(order) +
+           tester_stats.frames_quarantined.load(order);
+}
+
+static void _restart_controller(controller_health_t *health, int64_t now_us) {
+    twai_status_info_t status = {};
+    twai_get_status_info(&status);
+    const int64_t stop_us = esp_timer_get_time();
+    esp_err_t res = twai_stop();
+    if (res != ESP_OK) {
+        ESP_LOGW(health->tag, "Health: could not stop the controller: %s", esp_err_to_name(res));
+        return;
+    }
+    twai_clear_receive_queue();
+    res = twai_start();
+    const uint32_t stopped_us = esp_timer_get_time() - stop_us;
+    if (res != ESP_OK) {
+        ESP_LOGE(health->tag, "Health: could not start the controller: %s", esp_err_to_name(res));
+    }
+
+    health->resets++;
+    tester_stats_add(&tester_stats.controller_resets, 1);
+#if CONFIG_TWAI_TESTER_INCIDENT_LOG
+    incident_log_value(INCIDENT_CONTROLLER_RESET, stopped_us);
+#endif
+    if (stopped_us > health->max_stopped_us) {
+        health->max_stopped_us = stopped_us;
+    }
+    health->last_reset_us = now_us;
+    health->cost_end_us = esp_timer_get_time() + health->config.cost_window_ms * 1000LL;
+    health->cost_frames = _received_frames();
+    ESP_LOGW(health->tag,
+             "Health: controller restarted (#%lu) after %lu suspect events, stopped for %lu us, "
+             "%lu queued frames dropped",
+             health->resets, health->incident_events, stopped_us, status.msgs_to_rx);
+}
+
+// Quarantine the frames around a suspect event and restart the controller if the incident
+// collected enough events
+static void _suspect_event(controller_health_t *health, const char *reason, bool bus_running) {
+    const int64_t now_us = esp_timer_get_time();
+    const int64_t window_us = health->config.quarantine_ms * 1000LL;
+    if (health->incident_end_us == 0) {
+        health->incidents++;
+        health->incident_events = 0;
+        health->quarantine_start_us.store(now_us - window_us, std::memory_order_relaxed);
+        ESP_LOGW(health->tag, "Health: incident #%lu, quarantine of frames opened by %s",
+                 health->incidents, reason);
+    }
+    health->incident_events++;
+    health->incident_end_us = now_us + window_us;
+    health->quarantine_end_us.store(now_us + window_us, std::memory_order_release);
+
+    if (health->config.reset && bus_running &&
+        health->incident_events >= health->config.reset_events &&
+        (health->last_reset_us == 0 ||
+         now_us - health->last_reset_us >= health->config.reset_holdoff_ms * 1000LL)) {
+        _restart_controller(health, now_us);
+    }
+}
+
+static void _sample_counters(controller_health_t *health, int64_t now_us, bool bus_running) {
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) != ESP_OK) {
+        return;   // Driver not installed
+    }
+    const twai_status_info_t last = health->last_status;
+    const bool first = health->next_sample_us == 0;
+    health->last_status = status;
+    if (!first && status.tx_error_counter >= last.tx_error_counter + health->config.counter_rise) {
+        _suspect_event(health, "TEC rise", bus_running);
+    } else if (!first &&
+               status.rx_error_counter >= last.rx_error_counter + health->config.counter_rise) {
+        _suspect_event(health, "REC rise", bus_running);
+    }
+
+    // Frame rate of the last healthy second
+    if (health->incident_end_us == 0 && health->cost_end_us == 0 &&
+        now_us - health->baseline_start_us >= BASELINE_US) {
+        const uint32_t frames = _received_frames();
+        health->baseline_rate = (uint64_t)(frames - health->baseline_frames) * 1000000 /
+                                (now_us - health->baseline_start_us);
+        health->baseline_frames = frames;
+        health->baseline_start_us = now_us;
+    }
+}
+
+// Compare the frames received after the restart with the baseline rate
+static void _finish_cost(controller_health_t *health) {
+    const uint32_t received = _received_frames() - health->cost_frames;
+    const uint32_t expected =
+        (uint64_t)health->baseline_rate * health->config.cost_window_ms / 1000;
+    const uint32_t missing = expected > received ? expected - received : 0;
+    health->frames_missing += missing;
+    ESP_LOGI(health->tag,
+             "Health: %lu of %lu frames missing in the %lu ms after restart #%lu (total: %lu over "
+             "%lu restarts, max. stopped: %lu us)",
+             missing, expected, health->config.cost_window_ms, health->resets,
+             (uint32_t)health->frames_missing, health->resets, health->max_stopped_us);
+    health->cost_end_us = 0;
+    health->baseline_frames = _received_frames();
+    health->baseline_start_us = esp_timer_get_time();
+}
+
+void controller_health_init(controller_health_t *health, const controller_health_config_t *config,
+                            const char *tag) {
+    health->config = *config;
+    health->tag = tag;
+    health->quarantine_start_us.store(0, std::memory_order_relaxed);
+    health->quarantine_end_us.store(0, std::memory_order_release);
+    health->incident_end_us = 0;
+    health->incident_events = 0;
+    health->incidents = 0;
+    health->next_sample_us = 0;
+    health->last_status = {};
+    health->baseline_start_us = esp_timer_get_time();
+    health->baseline_frames = _received_frames();
+    health->baseline_rate = 0;
+    health->last_reset_us = 0;
+    health->cost_end_us = 0;
+    health->cost_frames = 0;
+    health->resets = 0;
+    health->max_stopped_us = 0;
+    health->frames_missing = 0;
+}
+
+void controller_health_resync(controller_health_t *health) {
+    health->next_sample_us = 0;
+    health->last_status = {};
+    health->baseline_start_us = esp_timer_get_time();
+    health->baseline_frames = _received_frames();
+    health->cost_end_us = 0;
+}
+
+void controller_health_handle_alerts(controller_health_t *health, uint32_t alerts,
+                                     bool bus_running) {
+    if (alerts & TWAI_ALERT_RX_FIFO_OVERRUN) {
+        _suspect_event(health, "RX_FIFO_OVERRUN", bus_running);
+    }
+    if (alerts & TWAI_ALERT_PERIPH_RESET) {
+        _suspect_event(health, "PERIPH_RESET", bus_running);
+    }
+    if (alerts & TWAI_ALERT_ERR_PASS) {
+        _suspect_event(health, "ERR_PASS", bus_running);
+    }
+}
+
+TickType_t controller_health_poll(controller_health_t *health, bool bus_running) {
+    const int64_t now_us = esp_timer_get_time();
+    if (now_us >= health->next_sample_us) {
+        _sample_counters(health, now_us, bus_running);
+        health->next_sample_us = now_us + health->config.sample_ms * 1000LL;
+    }
+    if (health->incident_end_us != 0 && now_us >= health->incident_end_us) {
+        ESP_LOGI(health->tag, "Health: incident #%lu closed after %lu suspect events",
+                 health->incidents, health->incident_events);
+        health->incident_end_us = 0;
+        // Collapse the window, its 32 bit bounds would match again every 2^32 us. The window
+        // ended with the incident, so only frames still waiting for the analysis task are
+        // validated after all.
+        health->quarantine_start_us.store(health->quarantine_end_us.load(std::memory_order_relaxed),
+                                          std::memory_order_relaxed);
+    }
+    if (health->cost_end_us != 0 && now_us >= health->cost_end_us) {
+        _finish_cost(health);
+    }
+
+    int64_t next_us = health->next_sample_us;
+    if (health->incident_end_us != 0 && health->incident_end_us < next_us) {
+        next_us = health->incident_end_us;
+    }
+    if (health->cost_end_us != 0 && health->cost_end_us < next_us) {
+        next_us = health->cost_end_us;
+    }
+    // Round up, so the deadline is not missed because of the tick resolution
+    return pdMS_TO_TICKS((next_us - now_us + 999) / 1000) + 1;
+}
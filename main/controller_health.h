@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "driver/twai.h"
+#include "freertos/FreeRTOS.h"
+
+typedef struct {
+    uint32_t quarantine_ms;      // Frames received this long before or after a suspect event
+    uint32_t sample_ms;          // Period of the error counter samples
+    uint32_t counter_rise;       // TEC or REC rise between two samples which counts as event
+    bool reset;                  // Restart the controller once an incident has reset_events
+    uint32_t reset_events;       // Suspect events of one incident which trigger the restart
+    uint32_t reset_holdoff_ms;   // Minimum time between two restarts
+    uint32_t cost_window_ms;     // Time after a restart over which the missing frames are counted
+} controller_health_config_t;
+
+// Watchdog of the controller health. RX_FIFO_OVERRUN, PERIPH_RESET and ERR_PASS alerts as well as
+// a fast rise of the error counters are suspect events: every frame received within
+// quarantine_ms of one is quarantined, and the events of overlapping windows form one incident.
+// Optionally the controller is stopped and started again, which drops the RX queue, once an
+// incident collects reset_events. The owner feeds the alerts and waits for the next alert at
+// most controller_health_poll() ticks, like bus_recovery_t; the analysis task only calls
+// controller_health_quarantined().
+typedef struct {
+    controller_health_config_t config;
+    const char *tag;
+    // Quarantine window, low 32 bits of the esp_timer time, empty with start == end. Written by
+    // the owner only and collapsed when the incident closes.
+    std::atomic<uint32_t> quarantine_start_us;
+    std::atomic<uint32_t> quarantine_end_us;
+    int64_t incident_end_us;   // 0 while no incident is open
+    uint32_t incident_events;
+    uint32_t incidents;
+    int64_t next_sample_us;
+    twai_status_info_t last_status;
+    // Frame rate before the restart as baseline of its cost
+    int64_t baseline_start_us;
+    uint32_t baseline_frames;
+    uint32_t baseline_rate;   // Frames per second
+    int64_t last_reset_us;
+    int64_t cost_end_us;    // 0 while no restart is measured
+    uint32_t cost_frames;   // Received frames at the restart
+    uint32_t resets;
+    uint32_t max_stopped_us;
+    uint64_t frames_missing;   // Below the baseline after the restarts, sum over all restarts
+} controller_health_t;
+
+void controller_health_init(controller_health_t *health, const controller_health_config_t *config,
+                            const char *tag);
+
+// Start the error counter sampling and the baseline frame rate over and drop a running restart
+// cost measurement, after the driver was restarted from outside. Incidents and counters are kept.
+void controller_health_resync(controller_health_t *health);
+
+// Take the suspect events from the alerts returned by twai_read_alerts(). While bus_running is
+// false, e.g. during a bus off recovery, the controller is not restarted.
+void controller_health_handle_alerts(controller_health_t *health, uint32_t alerts,
+                                     bool bus_running);
+
+// Sample the error counters, end incidents and restart measurements when due and return the
+// maximum number of ticks to wait for the next alert
+TickType_t controller_health_poll(controller_health_t *health, bool bus_running);
+
+// Whether a frame received at rx_timestamp_us falls into a quarantine window. Frames validated
+// before the owner saw the alert are not caught, the window only covers what is still queued.
+static inline bool controller_health_quarantined(const controller_health_t *health,
+                                                 int64_t rx_timestamp_us) {
+    // The end is stored last, so a new end always comes with its start
+    const uint32_t end = health->quarantine_end_us.load(std::memory_order_acquire);
+    const uint32_t start = health->quarantine_start_us.load(std::memory_order_relaxed);
+    const uint32_t timestamp = rx_timestamp_us;
+    return (int32_t)(timestamp - start) >= 0 && (int32_t)(end - timestamp) > 0;
+}
@@ -0,0 +1,74 @@
+#include "cpu_usage.h"
+
+#include <stdlib.h>
+
+#include "freertos/task.h"
+
+bool cpu_usage_sample(cpu_usage_sample_t *sample) {
+    cpu_usage_snapshot_t snapshot;
+    const bool res = cpu_usage_snapshot(&snapshot);
+    *sample = snapshot.sample;
+    cpu_usage_snapshot_free(&snapshot);
+    return res;
+}
+
+bool cpu_usage_snapshot(cpu_usage_snapshot_t *snapshot) {
+    *snapshot = {};
+    // Some headroom for tasks created while sampling
+    UBaseType_t count = uxTaskGetNumberOfTasks() + 4;
+    snapshot->tasks = (TaskStatus_t *)malloc(count * sizeof(TaskStatus_t));
+    if (snapshot->tasks == NULL) {
+        return false;
+    }
+
+    uint32_t total = 0;
+    count = uxTaskGetSystemState(snapshot->tasks, count, &total);
+    snapshot->count = count;
+    snapshot->sample.total = total;
+    for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+        TaskHandle_t idle = xTaskGetIdleTaskHandleForCore(core);
+        for (UBaseType_t i = 0; i < count; ++i) {
+            if (snapshot->tasks[i].xHandle == idle) {
+                snapshot->sample.idle[core] = snapshot->tasks[i].ulRunTimeCounter;
+                break;
+            }
+        }
+    }
+    return count != 0 && total != 0;
+}
+
+void cpu_usage_snapshot_free(cpu_usage_snapshot_t *snapshot) {
+    free(snapshot->tasks);
+    snapshot->tasks = NULL;
+    snapshot->count = 0;
+}
+
+uint32_t cpu_usage_busy_permille(const cpu_usage_sample_t *start, const cpu_usage_sample_t *end,
+                                 int core) {
+    const uint32_t total = end->total - start->total;
+    const uint32_t idle = end->idle[core] - start->idle[core];
+    if (total == 0 || idle > total) {
+        return 0;
+    }
+    return (uint64_t)(total - idle) * 1000 / total;
+}
+
+uint32_t cpu_usage_task_counter(TaskHandle_t task) {
+    if (task == NULL) {
+        return 0;
+    }
+    TaskStatus_t status;
+    // Passing a state skips its lookup, only the run time counter is used
+    vTaskGetInfo(task, &status, pdFALSE, eRunning);
+    return status.ulRunTimeCounter;
+}
+
+uint32_t cpu_usage_task_permille(const cpu_usage_sample_t *start, const cpu_usage_sample_t *end,
+                                 uint32_t task_start, uint32_t task_end) {
+    const uint32_t total = end->total - start->total;
+    const uint32_t task = task_end - task_start;
+    if (total == 0 || task > total) {
+        return 0;
+    }
+    return (uint64_t)task * 1000 / total;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Run time counters of the idle tasks, taken from the FreeRTOS run time statistics
+typedef struct {
+    uint32_t total;                        // Run time counter value when the sample was taken
+    uint32_t idle[portNUM_PROCESSORS];     // Run time of the idle task of each core
+} cpu_usage_sample_t;
+
+// States of all tasks together with the sample of the run time counters taken with them
+typedef struct {
+    cpu_usage_sample_t sample;
+    TaskStatus_t *tasks;   // Allocated by cpu_usage_snapshot(), NULL without memory
+    UBaseType_t count;
+} cpu_usage_snapshot_t;
+
+// Take a sample of the run time counters. Returns false if no statistics are available.
+bool cpu_usage_sample(cpu_usage_sample_t *sample);
+
+// Take the states of all tasks, release them with cpu_usage_snapshot_free(). Returns false if no
+// statistics are available.
+bool cpu_usage_snapshot(cpu_usage_snapshot_t *snapshot);
+
+void cpu_usage_snapshot_free(cpu_usage_snapshot_t *snapshot);
+
+// Load of a core between two samples in 1/10 percent
+uint32_t cpu_usage_busy_permille(const cpu_usage_sample_t *start, const cpu_usage_sample_t *end,
+                                 int core);
+
+// Run time counter of a single task, 0 if no statistics are available
+uint32_t cpu_usage_task_counter(TaskHandle_t task);
+
+// Share of one core taken by a task between two samples in 1/10 percent, from the task's run time
+// counters taken together with the samples
+uint32_t cpu_usage_task_permille(const cpu_usage_sample_t *start, const cpu_usage_sample_t *end,
+                                 uint32_t task_start, uint32_t task_end);
@@ -0,0 +1,105 @@
+#include "diag_benchmark.h"
+
+#include "bus_load.h"
+#include "diag_log.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "self_rx_bench.h"
+
+// Receive state of a run, only accessed by the calling task
+typedef struct {
+    const char *tag;
+    uint32_t received;
+    uint32_t logged;      // Lines printed for the received frames
+    uint64_t handle_us;   // Time spent in the per-frame handler
+} diag_bench_state_t;
+
+static const char *_level_name(diag_level_t level) {
+    switch (level) {
+        case DIAG_LEVEL_OFF:
+            return "compiled out";
+        case DIAG_LEVEL_RATE_LIMITED:
+            return "rate limited";
+        case DIAG_LEVEL_FULL:
+            return "full";
+    }
+    return "?";
+}
+
+// Same line as the tester prints for an unexpected frame, counted in *logged
+#define _BENCH_LOG(tag, format, ...)          \
+    do {                                      \
+        (*logged)++;                          \
+        ESP_LOGE(tag, format, ##__VA_ARGS__); \
+    } while (0)
+
+template <diag_level_t Level>
+static void _bench_handle(const twai_message_t *message, uint32_t *logged, const char *tag) {
+    DIAG_LOG_AT(Level, _BENCH_LOG, tag,
+                "\tMessage ID: 0x%lx (%li), len: %i, data: %02X %02X %02X %02X %02X %02X %02X "
+                "%02X",
+                message->identifier, message->identifier, message->data_length_code,
+                message->data[0], message->data[1], message->data[2], message->data[3],
+                message->data[4], message->data[5], message->data[6], message->data[7]);
+}
+
+template <diag_level_t Level>
+static void _bench_frame(const twai_message_t *message, void *arg) {
+    diag_bench_state_t *state = (diag_bench_state_t *)arg;
+    state->received++;
+    const int64_t handle_start_us = esp_timer_get_time();
+    _bench_handle<Level>(message, &state->logged, state->tag);
+    state->handle_us += esp_timer_get_time() - handle_start_us;
+}
+
+template <diag_level_t Level>
+static void _bench_report(const twai_general_config_t *g_config,
+                          const twai_timing_config_t *t_config, uint32_t period_us,
+                          uint32_t duration_ms, const char *tag) {
+    diag_bench_state_t state = {.tag = tag, .received = 0, .logged = 0, .handle_us = 0};
+    const self_rx_bench_config_t bench = {.name = "diag_bench",
+                                          .rx_queue_len = 0,
+                                          .alerts_enabled = TWAI_ALERT_NONE,
+                                          .data_length_code = 8,
+                                          .period_us = period_us,
+                                          .duration_ms = duration_ms,
+                                          .settle_ms = 0,
+                                          .on_tx = NULL,
+                                          .on_frame = _bench_frame<Level>,
+                                          .on_poll = NULL,
+                                          .on_start = NULL,
+                                          .on_stop = NULL,
+                                          .arg = &state};
+    self_rx_bench_result_t result;
+    esp_err_t res = self_rx_bench_run(g_config, t_config, &bench, &result);
+    if (res != ESP_OK) {
+        ESP_LOGW(tag, "Diag bench failed with logging %s: %s", _level_name(Level),
+                 esp_err_to_name(res));
+        return;
+    }
+    const uint32_t rate = (uint64_t)state.received * 1000000 / result.elapsed_us;
+    const uint32_t handle_avg_us = state.received != 0 ? state.handle_us / state.received : 0;
+    ESP_LOG_LEVEL_LOCAL(result.status.rx_missed_count != 0 ? ESP_LOG_WARN : ESP_LOG_INFO, tag,
+                        "Diag bench logging %-12s: sent: %lu, tx full: %lu, received: %lu "
+                        "(%lu frames/s), rx missed: %lu, logged: %lu, handler: %lu us/frame",
+                        _level_name(Level), result.sent, result.tx_rejected, state.received,
+                        rate, result.status.rx_missed_count, state.logged, handle_avg_us);
+}
+
+void diag_log_benchmark(const twai_general_config_t *g_config,
+                        const twai_timing_config_t *t_config, uint32_t duration_ms,
+                        const char *tag) {
+    twai_message_t frame = {};
+    frame.data_length_code = 8;
+    const uint32_t max_rate = twai_max_frame_rate(twai_timing_bitrate(t_config),
+                                                  twai_frame_bits(&frame, false));
+    ESP_LOGI(tag,
+             "Diag bench: %lu frames/s (bus max.), %d lines/s when rate limited, %lu ms per run, "
+             "build level: %s",
+             max_rate, DIAG_RATE_PER_S, duration_ms, _level_name(diag_level));
+
+    const uint32_t period_us = 1000000 / max_rate;
+    _bench_report<DIAG_LEVEL_FULL>(g_config, t_config, period_us, duration_ms, tag);
+    _bench_report<DIAG_LEVEL_RATE_LIMITED>(g_config, t_config, period_us, duration_ms, tag);
+    _bench_report<DIAG_LEVEL_OFF>(g_config, t_config, period_us, duration_ms, tag);
+}
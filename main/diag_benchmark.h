@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/twai.h"
+
+// Compare the sustainable RX rate with a log line per received frame at each diagnostic level,
+// built into one binary regardless of CONFIG_TWAI_TESTER_DIAG_LEVEL. Each run installs the
+// driver in no-ACK mode and receives its own frames at the max. frame rate of the bus for
+// duration_ms. As the queue benchmark, it needs a transceiver or a TX-RX jumper and the frames
+// are visible to other nodes on the bus. Must be called while the driver is not installed.
+void diag_log_benchmark(const twai_general_config_t *g_config,
+                        const twai_timing_config_t *t_config, uint32_t duration_ms,
+                        const char *tag);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+// Compile time level of the per-frame diagnostics. Counters, stream and trace capture are not
+// affected, only the log lines printed for single frames.
+typedef enum {
+    DIAG_LEVEL_OFF,            // No code is generated, the arguments are never evaluated
+    DIAG_LEVEL_RATE_LIMITED,   // At most DIAG_RATE_PER_S lines per second and call site
+    DIAG_LEVEL_FULL,           // Every line is printed
+} diag_level_t;
+
+#if CONFIG_TWAI_TESTER_DIAG_OFF
+inline constexpr diag_level_t diag_level = DIAG_LEVEL_OFF;
+#elif CONFIG_TWAI_TESTER_DIAG_RATE_LIMITED
+inline constexpr diag_level_t diag_level = DIAG_LEVEL_RATE_LIMITED;
+#else
+inline constexpr diag_level_t diag_level = DIAG_LEVEL_FULL;
+#endif
+
+#ifdef CONFIG_TWAI_TESTER_DIAG_RATE_PER_S
+#define DIAG_RATE_PER_S CONFIG_TWAI_TESTER_DIAG_RATE_PER_S
+#else
+#define DIAG_RATE_PER_S 10   // Kconfig default, no rate limited call site is built
+#endif
+
+// Budget of log lines per second of one call site. Only used by a single task.
+class DiagRateLimit {
+   public:
+    // Whether one more line fits into the current second. The lines dropped in the last second
+    // are reported once the next one starts.
+    bool allow(const char *tag) {
+        const TickType_t now = xTaskGetTickCount();
+        if (now - window_start_ >= pdMS_TO_TICKS(1000)) {
+            if (suppressed_ != 0) {
+                ESP_LOGW(tag, "%lu diagnostic lines suppressed", suppressed_);
+            }
+            window_start_ = now;
+            count_ = 0;
+            suppressed_ = 0;
+        }
+        if (count_ < DIAG_RATE_PER_S) {
+            count_++;
+            return true;
+        }
+        suppressed_++;
+        return false;
+    }
+
+   private:
+    TickType_t window_start_ = 0;
+    uint32_t count_ = 0;
+    uint32_t suppressed_ = 0;
+};
+
+// Log with one of the ESP_LOGx macros at a compile time diagnostic level. The discarded branches
+// of the if constexpr emit no code, so at DIAG_LEVEL_OFF neither the arguments are evaluated nor
+// the log lock is taken.
+#define DIAG_LOG_AT(level, log_macro, tag, format, ...)                \
+    do {                                                               \
+        if constexpr ((level) == DIAG_LEVEL_FULL) {                    \
+            log_macro(tag, format, ##__VA_ARGS__);                     \
+        } else if constexpr ((level) == DIAG_LEVEL_RATE_LIMITED) {     \
+            static DiagRateLimit _diag_limit;                          \
+            if (_diag_limit.allow(tag)) {                              \
+                log_macro(tag, format, ##__VA_ARGS__);                 \
+            }                                                          \
+        }                                                              \
+    } while (0)
+
+#define DIAG_LOGE(tag, format, ...) DIAG_LOG_AT(diag_level, ESP_LOGE, tag, format, ##__VA_ARGS__)
+#define DIAG_LOGW(tag, format, ...) DIAG_LOG_AT(diag_level, ESP_LOGW, tag, format, ##__VA_ARGS__)
+#define DIAG_LOGI(tag, format, ...) DIAG_LOG_AT(diag_level, ESP_LOGI, tag, format, ##__VA_ARGS__)
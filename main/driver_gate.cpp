@@ -0,0 +1,88 @@
+#include "driver_gate.h"
+
+#include <atomic>
+
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define GATE_OPEN_BIT BIT0
+
+// Sequentially consistent, the closer stores gate_closed and then reads gate_holders while a
+// holder increments gate_holders and then reads gate_closed
+static std::atomic<bool> gate_closed;
+static std::atomic<uint32_t> gate_holders;
+static std::atomic<uint32_t> gate_generation;
+static EventGroupHandle_t gate_events;   // GATE_OPEN_BIT while open, parked tasks wait for it
+static SemaphoreHandle_t gate_idle;      // Given by the last holder leaving a closed gate
+
+esp_err_t driver_gate_init(void) {
+    gate_events = xEventGroupCreate();
+    gate_idle = xSemaphoreCreateBinary();
+    if (gate_events == NULL || gate_idle == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    xEventGroupSetBits(gate_events, GATE_OPEN_BIT);
+    return ESP_OK;
+}
+
+static void _release(void) {
+    gate_closed.store(false);
+    xEventGroupSetBits(gate_events, GATE_OPEN_BIT);
+}
+
+bool driver_gate_try_enter(void) {
+    gate_holders.fetch_add(1);
+    if (gate_closed.load()) {
+        driver_gate_leave();
+        return false;
+    }
+    return true;
+}
+
+void driver_gate_enter(void) {
+    while (!driver_gate_try_enter()) {
+        xEventGroupWaitBits(gate_events, GATE_OPEN_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+}
+
+void driver_gate_leave(void) {
+    if (gate_holders.fetch_sub(1) == 1 && gate_closed.load()) {
+        xSemaphoreGive(gate_idle);
+    }
+}
+
+esp_err_t driver_gate_close(TickType_t timeout) {
+    if (gate_closed.load()) {
+        return ESP_OK;
+    }
+    xEventGroupClearBits(gate_events, GATE_OPEN_BIT);
+    xSemaphoreTake(gate_idle, 0);   // Drop a notification of an earlier close
+    gate_closed.store(true);
+    const TickType_t start = xTaskGetTickCount();
+    while (gate_holders.load() != 0) {
+        const TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout || xSemaphoreTake(gate_idle, timeout - elapsed) != pdTRUE) {
+            if (gate_holders.load() == 0) {
+                break;
+            }
+            _release();   // The driver was not touched, no new generation
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+    return ESP_OK;
+}
+
+void driver_gate_open(void) {
+    // Before the release, so every released task sees the new generation
+    gate_generation.fetch_add(1);
+    _release();
+}
+
+uint32_t driver_gate_generation(void) {
+    return gate_generation.load();
+}
+
+bool driver_gate_is_closed(void) {
+    return gate_closed.load();
+}
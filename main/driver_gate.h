@@ -0,0 +1,37 @@
+#pragma once
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+// Exclusive access to the TWAI driver, so the console can stop, uninstall and reinstall it while
+// the tester tasks run. Uninstalling deletes the queues and semaphores the tasks block on, so no
+// task may be inside the driver then. Every task holds the gate around its driver calls; once it
+// is closed, tasks entering it park until it opens again and the closer waits for the current
+// holders to leave.
+
+// Longest time a task may hold the gate, including a blocking driver call
+#define DRIVER_GATE_MAX_HOLD_MS 1000
+
+// Must be called before any task uses the gate
+esp_err_t driver_gate_init(void);
+
+// Enter the gate, parking the calling task while it is closed
+void driver_gate_enter(void);
+
+// Enter the gate only if it is open, for callers which must not block like esp_timer callbacks
+bool driver_gate_try_enter(void);
+
+void driver_gate_leave(void);
+
+// Close the gate and wait up to timeout until no task holds it. Only one task may close the
+// gate. Returns ESP_ERR_TIMEOUT and opens the gate again if a holder does not leave in time.
+esp_err_t driver_gate_close(TickType_t timeout);
+
+// Release the parked tasks after the driver was started again, which starts a new generation
+void driver_gate_open(void);
+
+// Incremented by each driver_gate_open(). Tasks keeping state of the driver, like the bus off
+// recovery, start over once it changed, the driver was restarted behind their back.
+uint32_t driver_gate_generation(void);
+
+bool driver_gate_is_closed(void);
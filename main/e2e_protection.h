@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// End to end protection in the layout of AUTOSAR E2E profile 1: data[0] carries a CRC-8 SAE J1850
+// over the 16 bit data ID (low byte first) and data[1..dlc-1], the low nibble of data[1] carries
+// a counter running from 0 to E2E_COUNTER_MAX.
+#define E2E_COUNTER_MAX 14
+#define E2E_CRC_BYTE 0
+#define E2E_COUNTER_BYTE 1
+
+// CRC-8 SAE J1850: polynomial 0x1D, start value and final XOR 0xFF. The ESP32 ROM CRC functions
+// only cover other polynomials, so the table is computed at compile time.
+class E2eCrc8 {
+   public:
+    constexpr E2eCrc8() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint8_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ kPolynomial) : (uint8_t)(crc << 1);
+            }
+            table_[i] = crc;
+        }
+    }
+
+    uint8_t compute(uint16_t data_id, const uint8_t *data, size_t len) const {
+        uint8_t crc = 0xFF;
+        crc = table_[crc ^ (uint8_t)data_id];
+        crc = table_[crc ^ (uint8_t)(data_id >> 8)];
+        for (size_t i = 0; i < len; ++i) {
+            crc = table_[crc ^ data[i]];
+        }
+        return crc ^ 0xFF;
+    }
+
+   private:
+    static constexpr uint8_t kPolynomial = 0x1D;
+    uint8_t table_[256] = {};
+};
+
+inline constexpr E2eCrc8 e2e_crc8;
+
+static inline uint8_t e2e_crc(uint16_t data_id, const uint8_t *data, uint8_t dlc) {
+    return e2e_crc8.compute(data_id, &data[E2E_COUNTER_BYTE], dlc - E2E_COUNTER_BYTE);
+}
+
+// Write counter and CRC into a frame of dlc >= 2 bytes
+static inline void e2e_protect(uint16_t data_id, uint8_t counter, uint8_t *data, uint8_t dlc) {
+    data[E2E_COUNTER_BYTE] = (data[E2E_COUNTER_BYTE] & 0xF0) | (counter & 0x0F);
+    data[E2E_CRC_BYTE] = e2e_crc(data_id, data, dlc);
+}
+
+static inline bool e2e_crc_ok(uint16_t data_id, const uint8_t *data, uint8_t dlc) {
+    return dlc >= 2 && data[E2E_CRC_BYTE] == e2e_crc(data_id, data, dlc);
+}
+
+static inline uint8_t e2e_counter(const uint8_t *data) { return data[E2E_COUNTER_BYTE] & 0x0F; }
+
+// Frames since the previous counter value: 0 for a repeated frame, 1 for the next one, more if
+// frames were lost in between
+static inline uint8_t e2e_counter_delta(uint8_t previous, uint8_t current) {
+    return (current + E2E_COUNTER_MAX + 1 - previous) % (E2E_COUNTER_MAX + 1);
+}
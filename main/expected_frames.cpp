@@ -0,0 +1,133 @@
+#include "expected_frames.h"
+
+#include "e2e_protection.h"
+#include "tester_stats.h"
+
+// All frames sent by the PC-Application or the load role of the second controller. Add further
+// cyclic frames here, the lookup index is rebuilt at compile time.
+static constexpr expected_frame_t expected_frames[] = {
+    // clang-format off
+    {.identifier = 0x1, .extd = false, .dlc = 8,
+     .data = {0xAB, 0xCD, 0xEF, 0x01, 0x23, 0x45, 0x67, 0x89},
+     .mask = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
+     .cycle_time_ms = 5,
+     .e2e = false, .e2e_data_id = 0},
+    // Counter and CRC protected frame for loss and integrity measurements
+    {.identifier = 0x2, .extd = false, .dlc = 8,
+     .data = {0x00, 0x00, 0x10, 0x32, 0x54, 0x76, 0x98, 0xBA},
+     .mask = {0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
+     .cycle_time_ms = 5,
+     .e2e = true, .e2e_data_id = 0x0002},
+    // clang-format on
+};
+static constexpr size_t expected_frames_size =
+    sizeof(expected_frames) / sizeof(expected_frames[0]);
+
+static constexpr ExpectedFrameIndex<expected_frames_size> expected_frames_index(expected_frames);
+static_assert(expected_frames_index.duplicates() == 0, "Duplicate ID in expected frame table");
+static_assert(expected_frames_size <= EXPECTED_FRAMES_MAX, "Too many expected frames");
+
+static expected_frame_stats_t expected_frames_stats[expected_frames_size];
+
+size_t expected_frame_count(void) { return expected_frames_size; }
+
+const expected_frame_t *expected_frame_at(size_t index) { return &expected_frames[index]; }
+
+expected_frame_stats_t *expected_frame_stats(size_t index) {
+    return &expected_frames_stats[index];
+}
+
+check_result_t expected_frame_check(const twai_message_t *canMessage, size_t *index) {
+    uint16_t pos = expected_frames_index.find(canMessage->identifier, canMessage->extd);
+    if (pos == ExpectedFrameIndex<expected_frames_size>::kNotFound) {
+        return CHECK_UNKNOWN_ID;
+    }
+    *index = pos;
+
+    const expected_frame_t *expected = &expected_frames[pos];
+    if (canMessage->data_length_code != expected->dlc) {
+        return CHECK_DLC_ERROR;
+    }
+    uint8_t diff = 0;
+    for (uint8_t i = 0; i < expected->dlc; ++i) {
+        diff |= (canMessage->data[i] ^ expected->data[i]) & expected->mask[i];
+    }
+    if (diff != 0) {
+        return CHECK_DATA_ERROR;
+    }
+    if (expected->e2e && (!e2e_crc_ok(expected->e2e_data_id, canMessage->data, expected->dlc) ||
+                          e2e_counter(canMessage->data) > E2E_COUNTER_MAX)) {
+        return CHECK_DATA_ERROR;
+    }
+    return CHECK_OK;
+}
+
+#define E2E_COUNTER_RANGE (E2E_COUNTER_MAX + 1)
+
+// Frames sent since the previous one received. Within half the counter range the counter delta
+// alone decides. Beyond that the counter may have wrapped, e.g. while the connector was pulled,
+// and the arrival time gives the number of cycles, corrected to the nearest value which matches
+// the counter delta.
+static uint32_t _frames_since(uint8_t delta, uint32_t cycle_us, int64_t elapsed_us) {
+    if (cycle_us == 0 || elapsed_us <= (int64_t)cycle_us * (E2E_COUNTER_RANGE / 2)) {
+        return delta;
+    }
+    const int64_t cycles = (elapsed_us + cycle_us / 2) / cycle_us;
+    const int64_t rounds = (cycles - delta + E2E_COUNTER_RANGE / 2) / E2E_COUNTER_RANGE;
+    return delta + rounds * E2E_COUNTER_RANGE;
+}
+
+// Follow the counter of an intact E2E frame. A counter which jumps back is counted as gap as
+// well, the 4 bit counter cannot tell reordering from loss.
+static void _record_counter(size_t index, expected_frame_stats_t *stats,
+                            const twai_message_t *canMessage, int64_t timestamp_us) {
+    const uint8_t counter = e2e_counter(canMessage->data);
+    if (stats->e2e_synced) {
+        const uint32_t frames = _frames_since(
+            e2e_counter_delta(stats->e2e_last_counter, counter),
+            expected_frames[index].cycle_time_ms * 1000, timestamp_us - stats->e2e_last_us);
+        if (frames == 0) {
+            tester_stats_add(&stats->frames_duplicate, 1);
+            tester_stats_add(&tester_stats.frames_duplicate, 1);
+        } else if (frames > 1) {
+            tester_stats_add(&stats->counter_gaps, 1);
+            tester_stats_add(&stats->frames_lost, frames - 1);
+            tester_stats_add(&tester_stats.frames_lost, frames - 1);
+        }
+    }
+    stats->e2e_last_us = timestamp_us;
+    stats->e2e_last_counter = counter;
+    stats->e2e_synced = true;
+}
+
+void expected_frame_record(size_t index, const twai_message_t *canMessage,
+                           check_result_t result, int64_t timestamp_us) {
+    expected_frame_stats_t *stats = &expected_frames_stats[index];
+    switch (result) {
+        case CHECK_OK:
+            tester_stats_add(&stats->frames_ok, 1);
+            if (expected_frames[index].e2e) {
+                _record_counter(index, stats, canMessage, timestamp_us);
+            }
+            break;
+        case CHECK_DLC_ERROR:
+            tester_stats_add(&stats->frames_dlc_error, 1);
+            break;
+        case CHECK_DATA_ERROR:
+            tester_stats_add(&stats->frames_data_error, 1);
+            break;
+        case CHECK_UNKNOWN_ID:
+            return;
+    }
+
+    const uint32_t cycle_us = expected_frames[index].cycle_time_ms * 1000;
+    if (cycle_us != 0 && stats->last_timestamp_us != 0) {
+        int64_t delta_us = timestamp_us - stats->last_timestamp_us;
+        if (delta_us > cycle_us + cycle_us / 2) {
+            tester_stats_add(&stats->frames_late, 1);
+        } else if (delta_us < cycle_us / 2) {
+            tester_stats_add(&stats->frames_early, 1);
+        }
+    }
+    stats->last_timestamp_us = timestamp_us;
+}
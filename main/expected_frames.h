@@ -0,0 +1,151 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "driver/twai.h"
+
+// Max. entries of the expected frame table, bounds the tables derived from it
+#define EXPECTED_FRAMES_MAX 64
+
+// Description of a frame which is expected on the bus
+typedef struct {
+    uint32_t identifier;
+    bool extd;
+    uint8_t dlc;
+    uint8_t data[TWAI_FRAME_MAX_DLC];
+    uint8_t mask[TWAI_FRAME_MAX_DLC];   // Only bits set in the mask are compared
+    uint32_t cycle_time_ms;             // 0 for event driven frames
+    // Counter and CRC in the E2E profile 1 layout, see e2e_protection.h. The mask must exclude
+    // both bytes, instead the CRC is checked and the counter is followed.
+    bool e2e;
+    uint16_t e2e_data_id;
+} expected_frame_t;
+
+// Result of the validation of a single received message
+typedef enum {
+    CHECK_OK,           // Expected ID with matching DLC and data
+    CHECK_DLC_ERROR,    // Expected ID, but wrong DLC
+    CHECK_DATA_ERROR,   // Expected ID, but data does not match the table entry or bad E2E CRC
+    CHECK_UNKNOWN_ID,   // ID not part of the expected frame table
+} check_result_t;
+
+// Counters of one entry of the expected frame table. Only written by the task validating the
+// frames, the counters may be read by any task.
+typedef struct {
+    std::atomic<uint32_t> frames_ok;
+    std::atomic<uint32_t> frames_dlc_error;
+    std::atomic<uint32_t> frames_data_error;
+    std::atomic<uint32_t> frames_late;    // Inter-arrival time above 1.5x the cycle time
+    std::atomic<uint32_t> frames_early;   // Inter-arrival time below 0.5x the cycle time
+    // E2E frames only
+    std::atomic<uint32_t> frames_lost;        // Counter values skipped, includes corrupt frames
+    std::atomic<uint32_t> counter_gaps;       // Jumps of the counter by more than one
+    std::atomic<uint32_t> frames_duplicate;   // Repeated counter value
+    // Only accessed by the validating task
+    int64_t last_timestamp_us;
+    int64_t e2e_last_us;   // Arrival of the frame with e2e_last_counter
+    uint8_t e2e_last_counter;
+    bool e2e_synced;   // e2e_last_counter is valid
+} expected_frame_stats_t;
+
+// Open addressing hash index from (identifier, extd) to the position in an expected frame table.
+// It is completely built at compile time, a lookup hashes once and probes at most max_probes()
+// slots, so the cost per frame does not grow with the number of table entries.
+template <size_t N>
+class ExpectedFrameIndex {
+   public:
+    static constexpr uint16_t kNotFound = 0xFFFF;
+
+    constexpr explicit ExpectedFrameIndex(const expected_frame_t (&table)[N]) {
+        for (size_t slot = 0; slot < kSlots; ++slot) {
+            index_[slot] = kNotFound;
+        }
+        for (size_t i = 0; i < N; ++i) {
+            uint32_t key = make_key(table[i].identifier, table[i].extd);
+            size_t slot = hash(key);
+            size_t probes = 1;
+            while (index_[slot] != kNotFound) {
+                if (keys_[slot] == key) {
+                    duplicates_++;
+                    break;
+                }
+                slot = (slot + 1) & (kSlots - 1);
+                probes++;
+            }
+            if (index_[slot] == kNotFound) {
+                keys_[slot] = key;
+                index_[slot] = i;
+            }
+            if (probes > max_probes_) {
+                max_probes_ = probes;
+            }
+        }
+    }
+
+    // Position of the frame in the table or kNotFound
+    uint16_t find(uint32_t identifier, bool extd) const {
+        const uint32_t key = make_key(identifier, extd);
+        size_t slot = hash(key);
+        for (size_t probe = 0; probe < max_probes_; ++probe) {
+            if (index_[slot] == kNotFound) {
+                return kNotFound;
+            }
+            if (keys_[slot] == key) {
+                return index_[slot];
+            }
+            slot = (slot + 1) & (kSlots - 1);
+        }
+        return kNotFound;
+    }
+
+    constexpr size_t max_probes() const { return max_probes_; }
+    constexpr size_t duplicates() const { return duplicates_; }
+
+   private:
+    static_assert(N < kNotFound, "Too many expected frames");
+
+    // Use at least twice as many slots as entries to keep the probe sequences short
+    static constexpr size_t slot_count() {
+        size_t slots = 2;
+        while (slots < 2 * N) {
+            slots <<= 1;
+        }
+        return slots;
+    }
+    static constexpr size_t kSlots = slot_count();
+
+    static constexpr uint32_t make_key(uint32_t identifier, bool extd) {
+        return identifier | (extd ? 0x80000000u : 0u);
+    }
+    // Fibonacci hashing onto the power of two slot count
+    static constexpr size_t hash(uint32_t key) {
+        return (uint32_t)(key * 2654435769u) >> (32 - __builtin_ctz(kSlots));
+    }
+
+    uint32_t keys_[kSlots] = {};
+    uint16_t index_[kSlots] = {};
+    size_t max_probes_ = 0;
+    size_t duplicates_ = 0;
+};
+
+// Number of entries of the expected frame table
+size_t expected_frame_count(void);
+
+// Entry of the expected frame table at position index
+const expected_frame_t *expected_frame_at(size_t index);
+
+// Counters of the table entry at position index
+expected_frame_stats_t *expected_frame_stats(size_t index);
+
+// Validate canMessage against the expected frame table. For all results except CHECK_UNKNOWN_ID
+// the position of the matching table entry is written to index.
+check_result_t expected_frame_check(const twai_message_t *canMessage, size_t *index);
+
+// Count the check result and the cycle time of a frame received at timestamp_us for the table
+// entry at position index, and for E2E entries follow the counter of intact frames. Must always
+// be called by the same task.
+void expected_frame_record(size_t index, const twai_message_t *canMessage,
+                           check_result_t result, int64_t timestamp_us);
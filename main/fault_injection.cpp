@@ -0,0 +1,83 @@
+#include "fault_injection.h"
+
+#include <atomic>
+
+#include "esp_rom_gpio.h"
+#include "esp_rom_sys.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "soc/gpio_sig_map.h"   // For GPIO matrix signal index
+#include "tester_stats.h"
+
+static fault_inject_config_t fault_config;
+static esp_timer_handle_t fault_timer;
+static std::atomic<bool> fault_running;
+
+// Route the TWAI signals as the driver does, or inverted with inverted set
+static void _route_signals(bool inverted) {
+    if (fault_config.mode == FAULT_INJECT_TX_INVERT) {
+        esp_rom_gpio_connect_out_signal(fault_config.tx_gpio, TWAI_TX_IDX, inverted, false);
+    } else {
+        esp_rom_gpio_connect_in_signal(fault_config.rx_gpio, TWAI_RX_IDX, inverted);
+    }
+}
+
+// Next interval between 0.5 and 1.5 times the configured one
+static uint64_t _next_interval_us(void) {
+    return fault_config.interval_us / 2 + esp_random() % (fault_config.interval_us + 1);
+}
+
+static void _fault_callback(void *arg) {
+    _route_signals(true);
+    esp_rom_delay_us(fault_config.duration_us);
+    _route_signals(false);
+    if (fault_config.counter != NULL) {
+        tester_stats_add(fault_config.counter, 1);
+    }
+
+    if (fault_running.load()) {
+        esp_timer_start_once(fault_timer, _next_interval_us());
+    }
+}
+
+esp_err_t fault_injection_start(const fault_inject_config_t *config) {
+    if (fault_timer != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    fault_config = *config;
+
+    const esp_timer_create_args_t timer_args = {.callback = _fault_callback,
+                                                .arg = NULL,
+                                                .dispatch_method = ESP_TIMER_TASK,
+                                                .name = "fault_inject",
+                                                .skip_unhandled_events = true};
+    esp_err_t res = esp_timer_create(&timer_args, &fault_timer);
+    if (res != ESP_OK) {
+        return res;
+    }
+    fault_running.store(true);
+    res = esp_timer_start_once(fault_timer, _next_interval_us());
+    if (res != ESP_OK) {
+        fault_running.store(false);
+        esp_timer_delete(fault_timer);
+        fault_timer = NULL;
+    }
+    return res;
+}
+
+void fault_injection_stop(void) {
+    if (fault_timer == NULL) {
+        return;
+    }
+    // A running callback may still re-arm the timer once, retry until it stays stopped
+    fault_running.store(false);
+    esp_timer_stop(fault_timer);
+    while (esp_timer_delete(fault_timer) == ESP_ERR_INVALID_STATE) {
+        vTaskDelay(1);
+        esp_timer_stop(fault_timer);
+    }
+    fault_timer = NULL;
+    _route_signals(false);
+}
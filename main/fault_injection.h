@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "driver/gpio.h"
+#include "esp_err.h"
+
+// Disturbance applied to the TWAI signals through the GPIO matrix
+typedef enum {
+    FAULT_INJECT_TX_INVERT,   // Drive the inverted TX signal onto the bus, all nodes see errors
+    FAULT_INJECT_RX_INVERT,   // Feed the inverted bus level to the controller only
+} fault_inject_mode_t;
+
+typedef struct {
+    fault_inject_mode_t mode;
+    gpio_num_t tx_gpio;
+    gpio_num_t rx_gpio;
+    uint32_t duration_us;             // Length of each disturbance
+    uint32_t interval_us;             // Mean time between two disturbances, randomized by +-50 %
+    std::atomic<uint32_t> *counter;   // Counts the disturbances, NULL to count none
+} fault_inject_config_t;
+
+// Start injecting disturbances from an esp_timer. The interval is randomized, so disturbances
+// hit all phases of cyclic reference frames. Each injection busy-waits for the duration in the
+// esp_timer task and is counted in config->counter.
+esp_err_t fault_injection_start(const fault_inject_config_t *config);
+
+// Stop injecting and restore the regular signal routing
+void fault_injection_stop(void);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// Fixed pool of N reference counted objects in static storage. Objects are passed between tasks
+// by pointer, so another processing stage takes a reference instead of copying the object.
+// alloc(), retain() and release() are lock-free and may be called from any task: the free slots
+// form a stack whose head carries a change counter, so a concurrent pop and push cannot corrupt
+// it (ABA problem).
+template <typename T, size_t N>
+class FramePool {
+    static_assert(N >= 1 && N < 0xFFFF, "Pool size must fit into a 16 bit index");
+
+   public:
+    FramePool() {
+        for (size_t i = 0; i < N; ++i) {
+            next_[i].store(i + 1 < N ? i + 1 : kNone, std::memory_order_relaxed);
+            refs_[i].store(0, std::memory_order_relaxed);
+        }
+        free_head_.store(make_head(0, 0), std::memory_order_release);
+    }
+
+    // Take a free object with a reference count of 1. Returns nullptr if the pool is exhausted.
+    T *alloc() {
+        uint32_t head = free_head_.load(std::memory_order_acquire);
+        uint16_t index;
+        do {
+            index = head & 0xFFFF;
+            if (index == kNone) {
+                return nullptr;
+            }
+            const uint16_t next = next_[index].load(std::memory_order_relaxed);
+            if (free_head_.compare_exchange_weak(head, make_head(next, head >> 16),
+                                                 std::memory_order_acquire,
+                                                 std::memory_order_acquire)) {
+                break;
+            }
+        } while (true);
+        refs_[index].store(1, std::memory_order_relaxed);
+        return &items_[index];
+    }
+
+    // Add a reference for another stage which releases the object on its own
+    void retain(T *item) { refs_[index_of(item)].fetch_add(1, std::memory_order_relaxed); }
+
+    // Drop a reference. The object returns to the pool with the last one.
+    void release(T *item) {
+        const uint16_t index = index_of(item);
+        if (refs_[index].fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        uint32_t head = free_head_.load(std::memory_order_relaxed);
+        do {
+            next_[index].store(head & 0xFFFF, std::memory_order_relaxed);
+        } while (!free_head_.compare_exchange_weak(head, make_head(index, head >> 16),
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed));
+    }
+
+    uint16_t index_of(const T *item) const { return item - items_; }
+    T *at(uint16_t index) { return &items_[index]; }
+
+    static constexpr size_t capacity() { return N; }
+
+   private:
+    static constexpr uint16_t kNone = 0xFFFF;
+
+    // Index of the top free slot in the lower, incremented change counter in the upper half
+    static constexpr uint32_t make_head(uint16_t index, uint32_t counter) {
+        return ((counter + 1) << 16) | index;
+    }
+
+    std::atomic<uint32_t> free_head_;
+    std::atomic<uint16_t> next_[N];   // Next free slot, only valid while the slot is free
+    std::atomic<uint8_t> refs_[N];
+    T items_[N];
+};
@@ -0,0 +1,173 @@
+#include "frame_stream.h"
+
+#include "sdkconfig.h"
+
+#if CONFIG_TWAI_TESTER_STREAM
+
+#include <stddef.h>
+#include <string.h>
+
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define STREAM_UART_NUM CONFIG_TWAI_TESTER_STREAM_UART_NUM
+#define STREAM_BUFFER_SIZE CONFIG_TWAI_TESTER_STREAM_BUFFER_SIZE
+#define STREAM_FLUSH_INTERVAL_MS CONFIG_TWAI_TESTER_STREAM_FLUSH_INTERVAL_MS
+
+static const char *TAG = "TWAI stream";
+
+// Two buffers: producers fill the active one while the writer task sends the other one
+static uint8_t stream_buffers[2][STREAM_BUFFER_SIZE] __attribute__((aligned(4)));
+static size_t stream_fill;           // Bytes used in the active buffer
+static uint8_t stream_active;        // Index of the buffer filled by the producers
+static size_t stream_ready_len;      // Bytes of the inactive buffer to send, 0 if it is free
+static uint16_t stream_sequence;
+static uint32_t stream_dropped;      // Records dropped since the last DROPPED record
+static portMUX_TYPE stream_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t stream_task_handle;
+
+static uint16_t _fletcher16(const uint8_t *data, size_t len) {
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+    for (size_t i = 0; i < len; ++i) {
+        sum1 = (sum1 + data[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
+
+// Hand the active buffer over to the writer. Must be called with stream_lock held.
+static bool _swap_locked(void) {
+    if (stream_ready_len != 0 || stream_fill == 0) {
+        return false;
+    }
+    stream_ready_len = stream_fill;
+    stream_active ^= 1;
+    stream_fill = 0;
+    return true;
+}
+
+// Copy a record into the active buffer. Must be called with stream_lock held.
+static void _append_locked(frame_stream_record_t *record) {
+    record->magic = FRAME_STREAM_MAGIC;
+    record->sequence = stream_sequence++;
+    record->checksum =
+        _fletcher16((const uint8_t *)record, offsetof(frame_stream_record_t, checksum));
+    memcpy(&stream_buffers[stream_active][stream_fill], record, sizeof(*record));
+    stream_fill += sizeof(*record);
+}
+
+static void _write(frame_stream_record_t *record) {
+    bool notify = false;
+    if (stream_task_handle == NULL) {
+        return;   // Not started
+    }
+
+    portENTER_CRITICAL(&stream_lock);
+    if (stream_fill + 2 * sizeof(*record) > STREAM_BUFFER_SIZE) {
+        notify = _swap_locked();
+    }
+    // Always keep room for a DROPPED record in front of the next record
+    if (stream_fill + 2 * sizeof(*record) > STREAM_BUFFER_SIZE) {
+        stream_dropped++;
+    } else {
+        if (stream_dropped != 0) {
+            frame_stream_record_t dropped = {};
+            dropped.type = FRAME_STREAM_RECORD_DROPPED;
+            dropped.timestamp_us = record->timestamp_us;
+            dropped.identifier = stream_dropped;
+            _append_locked(&dropped);
+            stream_dropped = 0;
+        }
+        _append_locked(record);
+    }
+    portEXIT_CRITICAL(&stream_lock);
+
+    if (notify) {
+        xTaskNotifyGive(stream_task_handle);
+    }
+}
+
+void frame_stream_write_frame(const twai_message_t *message, int64_t timestamp_us) {
+    frame_stream_record_t record = {};
+    record.type = FRAME_STREAM_RECORD_FRAME;
+    record.timestamp_us = timestamp_us;
+    record.identifier = message->identifier;
+    record.flags = message->flags;
+    record.dlc = message->data_length_code;
+    memcpy(record.data, message->data, sizeof(record.data));
+    _write(&record);
+}
+
+void frame_stream_write_alerts(uint32_t alerts, int64_t timestamp_us) {
+    frame_stream_record_t record = {};
+    record.type = FRAME_STREAM_RECORD_ALERTS;
+    record.timestamp_us = timestamp_us;
+    record.identifier = alerts;
+    _write(&record);
+}
+
+// Send full buffers, and partially filled ones after STREAM_FLUSH_INTERVAL_MS
+static void stream_task(void *arg) {
+    while (1) {
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(STREAM_FLUSH_INTERVAL_MS)) == 0) {
+            portENTER_CRITICAL(&stream_lock);
+            _swap_locked();
+            portEXIT_CRITICAL(&stream_lock);
+        }
+        if (stream_ready_len == 0) {
+            continue;
+        }
+
+        // Only the writer clears stream_ready_len, so the buffer is stable while it is sent
+        uart_write_bytes(STREAM_UART_NUM, stream_buffers[stream_active ^ 1], stream_ready_len);
+        portENTER_CRITICAL(&stream_lock);
+        stream_ready_len = 0;
+        portEXIT_CRITICAL(&stream_lock);
+    }
+}
+
+esp_err_t frame_stream_start(int core, int priority) {
+    const uart_config_t uart_config = {.baud_rate = CONFIG_TWAI_TESTER_STREAM_BAUDRATE,
+                                       .data_bits = UART_DATA_8_BITS,
+                                       .parity = UART_PARITY_DISABLE,
+                                       .stop_bits = UART_STOP_BITS_1,
+                                       .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+                                       .rx_flow_ctrl_thresh = 0,
+                                       .source_clk = UART_SCLK_DEFAULT};
+
+    // The UART TX ring buffer takes a whole stream buffer, so uart_write_bytes() copies and
+    // returns while the previous buffer is still shifted out
+    esp_err_t res = uart_driver_install(STREAM_UART_NUM, 256, 2 * STREAM_BUFFER_SIZE, 0, NULL, 0);
+    if (res == ESP_OK) {
+        res = uart_param_config(STREAM_UART_NUM, &uart_config);
+    }
+#if CONFIG_TWAI_TESTER_STREAM_UART_NUM != CONFIG_ESP_CONSOLE_UART_NUM
+    if (res == ESP_OK) {
+        res = uart_set_pin(STREAM_UART_NUM, CONFIG_TWAI_TESTER_STREAM_TX_GPIO, UART_PIN_NO_CHANGE,
+                           UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    }
+#endif
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Could not set up UART%d: %s", STREAM_UART_NUM, esp_err_to_name(res));
+        return res;
+    }
+
+    if (xTaskCreatePinnedToCore(stream_task, "TWAI_stream", 2048, NULL, priority,
+                                &stream_task_handle, core) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Binary stream on UART%d with %d baud", STREAM_UART_NUM,
+             CONFIG_TWAI_TESTER_STREAM_BAUDRATE);
+#if CONFIG_TWAI_TESTER_STREAM_UART_NUM == CONFIG_ESP_CONSOLE_UART_NUM
+    ESP_LOGW(TAG, "Stream shares the console UART, logging is switched off");
+    esp_log_level_set("*", ESP_LOG_NONE);
+#endif
+    return ESP_OK;
+}
+
+#endif   // CONFIG_TWAI_TESTER_STREAM
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/twai.h"
+#include "esp_err.h"
+
+#define FRAME_STREAM_MAGIC 0xA5
+
+typedef enum {
+    FRAME_STREAM_RECORD_FRAME = 1,     // Received frame
+    FRAME_STREAM_RECORD_ALERTS = 2,    // Alert bits in identifier
+    FRAME_STREAM_RECORD_DROPPED = 3,   // Number of records lost in identifier
+} frame_stream_record_type_t;
+
+// Fixed size record as written to the stream, all multi-byte fields are little endian
+typedef struct __attribute__((packed)) {
+    uint8_t magic;            // FRAME_STREAM_MAGIC
+    uint8_t type;             // frame_stream_record_type_t
+    uint16_t sequence;        // Incremented per record
+    uint32_t timestamp_us;    // Lower 32 bit of the esp_timer time
+    uint32_t identifier;      // CAN ID, alert bits or number of dropped records
+    uint8_t flags;            // twai_message_t flags (EXTD, RTR, ...)
+    uint8_t dlc;
+    uint8_t data[TWAI_FRAME_MAX_DLC];
+    uint16_t checksum;        // Fletcher-16 over all previous bytes of the record
+} frame_stream_record_t;
+static_assert(sizeof(frame_stream_record_t) == 24, "Record layout is part of the host protocol");
+
+// Install the UART and start the writer task. If the stream shares the UART with the console,
+// logging is switched off, as text would corrupt the binary stream.
+esp_err_t frame_stream_start(int core, int priority);
+
+// Append a record to the active buffer. Safe to call from any task, never blocks. Records are
+// dropped and counted if both buffers are in use.
+void frame_stream_write_frame(const twai_message_t *message, int64_t timestamp_us);
+void frame_stream_write_alerts(uint32_t alerts, int64_t timestamp_us);
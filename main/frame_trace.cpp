@@ -0,0 +1,160 @@
+#include "frame_trace.h"
+
+#include "sdkconfig.h"
+
+#if CONFIG_TWAI_TESTER_TRACE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#define TRACE_SIZE CONFIG_TWAI_TESTER_TRACE_SIZE
+#define TRACE_POST_TRIGGER CONFIG_TWAI_TESTER_TRACE_POST_TRIGGER
+#define TRACE_POST_TRIGGER_MS CONFIG_TWAI_TESTER_TRACE_POST_TRIGGER_MS
+
+static_assert((TRACE_SIZE & (TRACE_SIZE - 1)) == 0, "Trace size must be a power of two");
+static_assert(TRACE_POST_TRIGGER < TRACE_SIZE, "Post-trigger window must fit into the trace");
+
+typedef enum {
+    TRACE_ENTRY_FRAME,
+    TRACE_ENTRY_ALERTS,
+} trace_entry_type_t;
+
+typedef struct {
+    int64_t timestamp_us;
+    uint32_t value;   // CAN ID or alert bits
+    uint8_t type;     // trace_entry_type_t
+    uint8_t flags;
+    uint8_t dlc;
+    uint8_t data[TWAI_FRAME_MAX_DLC];
+} trace_entry_t;
+
+typedef enum {
+    TRACE_RECORDING,
+    TRACE_TRIGGERED,   // Recording the post-trigger window
+    TRACE_FROZEN,      // Waiting to be dumped
+} trace_state_t;
+
+static const char *const trace_trigger_names[] = {"DLC error", "data error", "RX_FIFO_OVERRUN",
+                                                  "BUS_OFF"};
+
+// Placed in PSRAM if external memory is enabled for .bss, otherwise in DRAM
+EXT_RAM_BSS_ATTR static trace_entry_t trace_entries[TRACE_SIZE];
+static uint32_t trace_head;   // Number of entries written since the last restart
+static trace_state_t trace_state;
+static uint32_t trace_trigger_head;   // trace_head when the trigger occurred
+static uint32_t trace_post_remaining;
+static int64_t trace_trigger_us;
+static frame_trace_trigger_t trace_trigger_reason;
+static uint32_t trace_missed;   // Entries not recorded while frozen
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void _append(const trace_entry_t *entry) {
+    portENTER_CRITICAL(&trace_lock);
+    if (trace_state == TRACE_FROZEN) {
+        trace_missed++;
+    } else {
+        trace_entries[trace_head & (TRACE_SIZE - 1)] = *entry;
+        trace_head++;
+        if (trace_state == TRACE_TRIGGERED && --trace_post_remaining == 0) {
+            trace_state = TRACE_FROZEN;
+        }
+    }
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+void frame_trace_record_frame(const twai_message_t *message, int64_t timestamp_us) {
+    trace_entry_t entry;
+    entry.timestamp_us = timestamp_us;
+    entry.value = message->identifier;
+    entry.type = TRACE_ENTRY_FRAME;
+    entry.flags = message->flags;
+    entry.dlc = message->data_length_code;
+    memcpy(entry.data, message->data, sizeof(entry.data));
+    _append(&entry);
+}
+
+void frame_trace_record_alerts(uint32_t alerts, int64_t timestamp_us) {
+    trace_entry_t entry = {};
+    entry.timestamp_us = timestamp_us;
+    entry.value = alerts;
+    entry.type = TRACE_ENTRY_ALERTS;
+    _append(&entry);
+
+    if (alerts & TWAI_ALERT_BUS_OFF) {
+        frame_trace_trigger(FRAME_TRACE_TRIGGER_BUS_OFF, timestamp_us);
+    } else if (alerts & TWAI_ALERT_RX_FIFO_OVERRUN) {
+        frame_trace_trigger(FRAME_TRACE_TRIGGER_RX_FIFO_OVERRUN, timestamp_us);
+    }
+}
+
+void frame_trace_trigger(frame_trace_trigger_t trigger, int64_t timestamp_us) {
+    portENTER_CRITICAL(&trace_lock);
+    if (trace_state == TRACE_RECORDING) {
+        trace_state = TRACE_TRIGGERED;
+        trace_trigger_head = trace_head;
+        trace_post_remaining = TRACE_POST_TRIGGER;
+        trace_trigger_us = timestamp_us;
+        trace_trigger_reason = trigger;
+        if (trace_post_remaining == 0) {
+            trace_state = TRACE_FROZEN;
+        }
+    }
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+static void _print_entry(const char *tag, const trace_entry_t *entry) {
+    const int32_t offset_us = entry->timestamp_us - trace_trigger_us;
+    if (entry->type == TRACE_ENTRY_ALERTS) {
+        ESP_LOGW(tag, "\t%+9ld us alerts: 0x%08lx", offset_us, entry->value);
+        return;
+    }
+    char data[3 * TWAI_FRAME_MAX_DLC + 1] = "";
+    const uint8_t len = entry->dlc > TWAI_FRAME_MAX_DLC ? TWAI_FRAME_MAX_DLC : entry->dlc;
+    for (uint8_t i = 0; i < len; ++i) {
+        snprintf(&data[3 * i], sizeof(data) - 3 * i, " %02X", entry->data[i]);
+    }
+    ESP_LOGW(tag, "\t%+9ld us 0x%0*lx%s [%u]%s", offset_us,
+             (entry->flags & TWAI_MSG_FLAG_EXTD) ? 8 : 3, entry->value,
+             (entry->flags & TWAI_MSG_FLAG_RTR) ? " rtr" : "", entry->dlc, data);
+}
+
+void frame_trace_dump_if_frozen(const char *tag) {
+    portENTER_CRITICAL(&trace_lock);
+    // End a post-trigger window which does not fill up, e.g. because the bus is off
+    if (trace_state == TRACE_TRIGGERED &&
+        esp_timer_get_time() - trace_trigger_us >= TRACE_POST_TRIGGER_MS * 1000LL) {
+        trace_state = TRACE_FROZEN;
+    }
+    const bool frozen = trace_state == TRACE_FROZEN;
+    portEXIT_CRITICAL(&trace_lock);
+    if (!frozen) {
+        return;
+    }
+
+    // Nothing writes the entries while frozen, so they are printed without the lock
+    const uint32_t first = trace_head > TRACE_SIZE ? trace_head - TRACE_SIZE : 0;
+    ESP_LOGW(tag, "Trace triggered by %s: %lu entries before, %lu after",
+             trace_trigger_names[trace_trigger_reason], trace_trigger_head - first,
+             trace_head - trace_trigger_head);
+    for (uint32_t i = first; i < trace_head; ++i) {
+        if (i == trace_trigger_head) {
+            ESP_LOGW(tag, "\t---- %s ----", trace_trigger_names[trace_trigger_reason]);
+        }
+        _print_entry(tag, &trace_entries[i & (TRACE_SIZE - 1)]);
+    }
+
+    portENTER_CRITICAL(&trace_lock);
+    const uint32_t missed = trace_missed;
+    trace_missed = 0;
+    trace_head = 0;
+    trace_state = TRACE_RECORDING;
+    portEXIT_CRITICAL(&trace_lock);
+    ESP_LOGW(tag, "Trace restarted, %lu entries missed while frozen", missed);
+}
+
+#endif   // CONFIG_TWAI_TESTER_TRACE
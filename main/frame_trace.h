@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/twai.h"
+
+// Event which freezes the trace
+typedef enum {
+    FRAME_TRACE_TRIGGER_DLC_ERROR,
+    FRAME_TRACE_TRIGGER_DATA_ERROR,
+    FRAME_TRACE_TRIGGER_RX_FIFO_OVERRUN,
+    FRAME_TRACE_TRIGGER_BUS_OFF,
+} frame_trace_trigger_t;
+
+// Always-on circular trace of the last received frames and alerts. On a trigger, recording goes
+// on for a post-trigger window and then stops, so the entries before and after the incident are
+// kept until they are dumped. Recording is a copy into a static buffer and never allocates.
+
+// Record a received frame. Safe to call from any task.
+void frame_trace_record_frame(const twai_message_t *message, int64_t timestamp_us);
+
+// Record raised alerts. Triggers the trace on RX_FIFO_OVERRUN and BUS_OFF.
+void frame_trace_record_alerts(uint32_t alerts, int64_t timestamp_us);
+
+// Trigger the trace. Ignored while a trigger is pending or the trace is frozen.
+void frame_trace_trigger(frame_trace_trigger_t trigger, int64_t timestamp_us);
+
+// If the post-trigger window is complete, print the frozen trace and restart recording. Call it
+// regularly from a task which may log.
+void frame_trace_dump_if_frozen(const char *tag);
@@ -0,0 +1,419 @@
+#include "incident_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "tester_stats.h"
+
+#define NVS_NAMESPACE "twai_incidents"
+#define BOOT_KEY "boot"
+
+// Start of each blob, followed by the records
+typedef struct {
+    uint32_t seq;   // Number of the block since the log was cleared
+} block_header_t;
+
+static incident_log_config_t log_config;
+static const char *log_tag;
+static QueueHandle_t log_queue;
+static SemaphoreHandle_t log_lock;   // Guards the NVS handle and the pending block
+static nvs_handle_t log_nvs;
+static uint16_t log_boot;
+static std::atomic<uint32_t> log_dropped;   // Records not queued because the queue was full
+// Corrupt frames over the limit, added by the analysis task and taken by the writer task
+static std::atomic<uint32_t> log_frames_suppressed;
+// Corrupt frames recorded in the current minute, only accessed by incident_log_frame()
+static int64_t log_frame_window_us;
+static uint32_t log_frame_window_count;
+
+// Block being filled, only changed by the writer task and the clear with log_lock held
+static block_header_t *pending;
+static incident_record_t *pending_records;
+static uint32_t pending_count;
+static uint32_t pending_written;   // Records of the pending block already in NVS
+// Blob buffer for reading stored blocks with log_lock held
+static block_header_t *read_block;
+
+static size_t _block_size(uint32_t count) {
+    return sizeof(block_header_t) + count * sizeof(incident_record_t);
+}
+
+static void _block_key(uint32_t seq, char *key, size_t size) {
+    snprintf(key, size, "blk%03lu", seq % log_config.blocks);
+}
+
+// Read the block stored in the slot of seq. Returns the number of records, or -1 if the slot
+// is empty or holds another block.
+static int32_t _read_block(uint32_t slot_seq, block_header_t *block, bool match_seq) {
+    char key[16];
+    _block_key(slot_seq, key, sizeof(key));
+    size_t size = _block_size(log_config.batch_records);
+    if (nvs_get_blob(log_nvs, key, block, &size) != ESP_OK || size < sizeof(block_header_t)) {
+        return -1;
+    }
+    if (match_seq && block->seq != slot_seq) {
+        return -1;   // Left over from an earlier round through the slots
+    }
+    return (size - sizeof(block_header_t)) / sizeof(incident_record_t);
+}
+
+// Write the pending block and start the next one once it is full
+static void _write_pending(void) {
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    char key[16];
+    _block_key(pending->seq, key, sizeof(key));
+    esp_err_t res = nvs_set_blob(log_nvs, key, pending, _block_size(pending_count));
+    if (res == ESP_OK) {
+        res = nvs_commit(log_nvs);
+    }
+    if (res != ESP_OK) {
+        ESP_LOGW(log_tag, "Incident log: could not write block %lu: %s", pending->seq,
+                 esp_err_to_name(res));
+    } else if (pending_count == log_config.batch_records) {
+        pending->seq++;
+        pending_count = 0;
+        pending_written = 0;
+    } else {
+        pending_written = pending_count;
+    }
+    xSemaphoreGive(log_lock);
+}
+
+// Add a record to the pending block, which must not be full
+static void _append(const incident_record_t *record) {
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    pending_records[pending_count++] = *record;
+    xSemaphoreGive(log_lock);
+}
+
+static void _fill_header(incident_record_t *record, incident_type_t type) {
+    *record = {};
+    record->uptime_s = esp_timer_get_time() / 1000000;
+    record->boot = log_boot;
+    record->type = type;
+}
+
+static void _checkpoint(incident_record_t *record) {
+    tester_stats_snapshot_t stats;
+    tester_stats_snapshot(&stats);
+    _fill_header(record, INCIDENT_CHECKPOINT);
+    record->checkpoint.frames_ok = stats.frames_ok;
+    record->checkpoint.frames_error = stats.frames_dlc_error + stats.frames_data_error;
+    record->checkpoint.frames_lost = stats.frames_lost;
+    record->checkpoint.rx_missed = stats.rx_missed;
+    record->checkpoint.bus_off = stats.bus_off;
+    record->checkpoint.ring_drops = stats.ring_drops;
+}
+
+static TickType_t _remaining(TickType_t since, TickType_t period, TickType_t now) {
+    const TickType_t elapsed = now - since;
+    return elapsed >= period ? 0 : period - elapsed;
+}
+
+// Only called by the writer task, which is the only one changing pending_count
+static bool _pending_full(void) {
+    return pending_count == log_config.batch_records;
+}
+
+static bool _pending_unwritten(void) {
+    return pending_written != pending_count;
+}
+
+// Append the count of corrupt frames which were not recorded, if any
+static void _append_suppressed(void) {
+    const uint32_t suppressed = log_frames_suppressed.exchange(0, std::memory_order_relaxed);
+    if (suppressed != 0) {
+        incident_record_t record;
+        _fill_header(&record, INCIDENT_FRAMES_SUPPRESSED);
+        record.value = suppressed;
+        _append(&record);
+    }
+}
+
+// Append the queued records and write the pending block once it is full or its oldest unwritten
+// record is flush_interval_ms old, but at most once per min_write_interval_ms. Each write stalls
+// both cores, so while a block waits for its write the records queue up and are dropped once
+// the queue is full.
+static void _writer_task(void *arg) {
+    const TickType_t flush_ticks = pdMS_TO_TICKS(log_config.flush_interval_ms);
+    const TickType_t write_ticks = pdMS_TO_TICKS(log_config.min_write_interval_ms);
+    const TickType_t checkpoint_ticks = pdMS_TO_TICKS(log_config.checkpoint_interval_ms);
+    TickType_t now = xTaskGetTickCount();
+    TickType_t last_write = now - write_ticks;
+    TickType_t last_checkpoint = now;
+    TickType_t unwritten_since = now;   // Time of the oldest record not written yet
+    bool checkpoint_due = false;
+    incident_record_t record;
+    for (;;) {
+        now = xTaskGetTickCount();
+        TickType_t wait = portMAX_DELAY;
+        if (checkpoint_ticks != 0) {
+            wait = _remaining(last_checkpoint, checkpoint_ticks, now);
+        }
+        if (_pending_unwritten()) {
+            TickType_t write_wait =
+                _pending_full() ? 0 : _remaining(unwritten_since, flush_ticks, now);
+            const TickType_t holdoff = _remaining(last_write, write_ticks, now);
+            if (holdoff > write_wait) {
+                write_wait = holdoff;
+            }
+            if (write_wait < wait) {
+                wait = write_wait;
+            }
+        }
+        if (!_pending_full()) {
+            if (xQueueReceive(log_queue, &record, wait) == pdTRUE) {
+                if (!_pending_unwritten()) {
+                    unwritten_since = xTaskGetTickCount();
+                }
+                _append(&record);
+            }
+        } else {
+            vTaskDelay(wait);   // The queue takes the records until the block is written
+        }
+
+        now = xTaskGetTickCount();
+        if (checkpoint_ticks != 0 && now - last_checkpoint >= checkpoint_ticks) {
+            last_checkpoint += checkpoint_ticks;
+            checkpoint_due = true;
+        }
+        if (checkpoint_due && !_pending_full()) {
+            if (!_pending_unwritten()) {
+                unwritten_since = now;
+            }
+            _checkpoint(&record);
+            _append(&record);
+            checkpoint_due = false;
+        }
+        if (_pending_unwritten() &&
+            (_pending_full() || now - unwritten_since >= flush_ticks) &&
+            now - last_write >= write_ticks) {
+            if (!_pending_full()) {
+                _append_suppressed();
+            }
+            _write_pending();
+            last_write = now;
+            unwritten_since = now;
+        }
+    }
+}
+
+static const char *const record_names[] = {"start", "bus off", "recovered", "RX FIFO overrun",
+                                           "controller restart", "DLC error", "data error",
+                                           "checkpoint", "corrupt frames not recorded"};
+
+static void _print_record(const char *tag, const incident_record_t *record) {
+    const char *name = record->type < sizeof(record_names) / sizeof(record_names[0])
+                           ? record_names[record->type]
+                           : "?";
+    switch (record->type) {
+        case INCIDENT_BOOT:
+            ESP_LOGI(tag, "\t#%-5u %8lu s %s, reset reason: %lu", record->boot, record->uptime_s,
+                     name, record->value);
+            break;
+        case INCIDENT_BUS_OFF:
+            ESP_LOGI(tag, "\t#%-5u %8lu s %s #%lu", record->boot, record->uptime_s, name,
+                     record->value);
+            break;
+        case INCIDENT_RECOVERED:
+        case INCIDENT_CONTROLLER_RESET:
+            ESP_LOGI(tag, "\t#%-5u %8lu s %s after %lu us", record->boot, record->uptime_s, name,
+                     record->value);
+            break;
+        case INCIDENT_FRAMES_SUPPRESSED:
+            ESP_LOGI(tag, "\t#%-5u %8lu s %lu %s", record->boot, record->uptime_s, record->value,
+                     name);
+            break;
+        case INCIDENT_RX_OVERRUN:
+            ESP_LOGI(tag, "\t#%-5u %8lu s %s, alerts: 0x%08lx", record->boot, record->uptime_s,
+                     name, record->value);
+            break;
+        case INCIDENT_DLC_ERROR:
+        case INCIDENT_DATA_ERROR: {
+            char data[3 * TWAI_FRAME_MAX_DLC + 1] = "";
+            const uint8_t len = record->frame.dlc > TWAI_FRAME_MAX_DLC ? TWAI_FRAME_MAX_DLC
+                                                                       : record->frame.dlc;
+            for (uint8_t i = 0; i < len; ++i) {
+                snprintf(&data[3 * i], sizeof(data) - 3 * i, " %02X", record->frame.data[i]);
+            }
+            ESP_LOGI(tag, "\t#%-5u %8lu s %s 0x%0*lx [%u]%s", record->boot, record->uptime_s,
+                     name, (record->flags & TWAI_MSG_FLAG_EXTD) ? 8 : 3,
+                     record->frame.identifier, record->frame.dlc, data);
+            break;
+        }
+        case INCIDENT_CHECKPOINT:
+            ESP_LOGI(tag,
+                     "\t#%-5u %8lu s %s, ok: %lu, errors: %lu, lost: %lu, rx missed: %lu, bus "
+                     "off: %lu, ring drops: %lu",
+                     record->boot, record->uptime_s, name, record->checkpoint.frames_ok,
+                     record->checkpoint.frames_error, record->checkpoint.frames_lost,
+                     record->checkpoint.rx_missed, record->checkpoint.bus_off,
+                     record->checkpoint.ring_drops);
+            break;
+        default:
+            ESP_LOGI(tag, "\t#%-5u %8lu s type %u", record->boot, record->uptime_s, record->type);
+            break;
+    }
+}
+
+void incident_log_print(const char *tag) {
+    if (log_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    const uint32_t head = pending->seq;
+    const uint32_t oldest = head >= log_config.blocks - 1 ? head - (log_config.blocks - 1) : 0;
+    uint32_t stored = 0;
+    ESP_LOGI(tag, "Incident log: start #%u, blocks %lu to %lu, %lu records dropped", log_boot,
+             oldest, head, log_dropped.load(std::memory_order_relaxed));
+    const incident_record_t *records = (const incident_record_t *)(read_block + 1);
+    for (uint32_t seq = oldest; seq < head; ++seq) {
+        const int32_t count = _read_block(seq, read_block, true);
+        for (int32_t i = 0; i < count; ++i) {
+            _print_record(tag, &records[i]);
+        }
+        stored += count > 0 ? count : 0;
+    }
+    // The pending block is printed from RAM, its stored part may be older
+    for (uint32_t i = 0; i < pending_count; ++i) {
+        _print_record(tag, &pending_records[i]);
+    }
+    ESP_LOGI(tag, "Incident log: %lu records, %lu of them not written yet",
+             stored + pending_count, pending_count - pending_written);
+    xSemaphoreGive(log_lock);
+}
+
+esp_err_t incident_log_clear(void) {
+    if (log_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    xQueueReset(log_queue);
+    esp_err_t res = nvs_erase_all(log_nvs);
+    if (res == ESP_OK) {
+        res = nvs_set_u32(log_nvs, BOOT_KEY, log_boot);   // Keep the start numbers unique
+    }
+    if (res == ESP_OK) {
+        res = nvs_commit(log_nvs);
+    }
+    pending->seq = 0;
+    pending_count = 0;
+    pending_written = 0;
+    log_dropped.store(0, std::memory_order_relaxed);
+    log_frames_suppressed.store(0, std::memory_order_relaxed);
+    xSemaphoreGive(log_lock);
+    return res;
+}
+
+static void _queue(const incident_record_t *record) {
+    if (log_queue == NULL) {
+        return;
+    }
+    if (xQueueSend(log_queue, record, 0) != pdTRUE) {
+        log_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void incident_log_value(incident_type_t type, uint32_t value) {
+    incident_record_t record;
+    _fill_header(&record, type);
+    record.value = value;
+    _queue(&record);
+}
+
+void incident_log_frame(incident_type_t type, const twai_message_t *message) {
+    if (log_queue == NULL) {
+        return;
+    }
+    const int64_t now_us = esp_timer_get_time();
+    if (now_us - log_frame_window_us >= 60 * 1000000LL) {
+        log_frame_window_us = now_us;
+        log_frame_window_count = 0;
+    }
+    if (log_frame_window_count >= log_config.frames_per_minute) {
+        log_frames_suppressed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    log_frame_window_count++;
+
+    incident_record_t record;
+    _fill_header(&record, type);
+    record.flags = message->flags;
+    record.frame.identifier = message->identifier;
+    record.frame.dlc = message->data_length_code;
+    for (int i = 0; i < TWAI_FRAME_MAX_DLC; ++i) {
+        record.frame.data[i] = message->data[i];
+    }
+    _queue(&record);
+}
+
+// Continue after the newest stored block
+static uint32_t _find_head(void) {
+    uint32_t head = 0;
+    for (uint32_t slot = 0; slot < log_config.blocks; ++slot) {
+        if (_read_block(slot, read_block, false) >= 0 && read_block->seq >= head) {
+            head = read_block->seq + 1;
+        }
+    }
+    return head;
+}
+
+esp_err_t incident_log_start(const incident_log_config_t *config, bool print_stored,
+                             const char *tag, int core, int priority) {
+    log_config = *config;
+    log_tag = tag;
+
+    esp_err_t res = nvs_flash_init();
+    if (res == ESP_ERR_NVS_NO_FREE_PAGES || res == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        nvs_flash_erase();
+        res = nvs_flash_init();
+    }
+    if (res == ESP_OK) {
+        res = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &log_nvs);
+    }
+    if (res != ESP_OK) {
+        return res;
+    }
+
+    uint32_t boot = 0;
+    nvs_get_u32(log_nvs, BOOT_KEY, &boot);   // Not found on the first start
+    log_boot = ++boot;
+    res = nvs_set_u32(log_nvs, BOOT_KEY, boot);
+    if (res == ESP_OK) {
+        res = nvs_commit(log_nvs);
+    }
+    if (res != ESP_OK) {
+        return res;
+    }
+
+    pending = (block_header_t *)malloc(_block_size(config->batch_records));
+    read_block = (block_header_t *)malloc(_block_size(config->batch_records));
+    log_lock = xSemaphoreCreateMutex();
+    log_queue = xQueueCreate(config->queue_len, sizeof(incident_record_t));
+    if (pending == NULL || read_block == NULL || log_lock == NULL || log_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    pending_records = (incident_record_t *)(pending + 1);
+    pending->seq = _find_head();
+    if (print_stored) {
+        incident_log_print(tag);
+    }
+
+    incident_log_value(INCIDENT_BOOT, esp_reset_reason());
+    if (xTaskCreatePinnedToCore(_writer_task, "TWAI_incidents", 4096, NULL, priority, NULL,
+                                core) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/twai.h"
+#include "esp_err.h"
+
+// Persistent log of incidents for soak tests. Records are queued without blocking by the tasks
+// which detect an incident and written in batches to the NVS partition by a low priority task.
+// NVS spreads the writes over its pages, so rewriting the same blocks does not wear out single
+// flash sectors. The oldest block is overwritten once all blocks are used.
+typedef enum {
+    INCIDENT_BOOT,                // value: esp_reset_reason() of this start
+    INCIDENT_BUS_OFF,             // value: bus offs since the start
+    INCIDENT_RECOVERED,           // value: time from bus off until the driver was started (us)
+    INCIDENT_RX_OVERRUN,          // value: all alerts raised together with the overrun
+    INCIDENT_CONTROLLER_RESET,    // value: time the controller was stopped (us)
+    INCIDENT_DLC_ERROR,           // frame: the corrupt frame
+    INCIDENT_DATA_ERROR,          // frame: the corrupt frame
+    INCIDENT_CHECKPOINT,          // checkpoint: counters of this start
+    INCIDENT_FRAMES_SUPPRESSED,   // value: corrupt frames over frames_per_minute, not recorded
+} incident_type_t;
+
+typedef struct {
+    uint32_t uptime_s;   // Time since the start of the tester
+    uint16_t boot;       // Number of the start, counts up over resets
+    uint8_t type;        // incident_type_t
+    uint8_t flags;       // TWAI_MSG_FLAG_* of a frame
+    union {
+        uint32_t value;
+        struct {
+            uint32_t identifier;
+            uint8_t dlc;
+            uint8_t data[TWAI_FRAME_MAX_DLC];
+        } frame;
+        struct {
+            uint32_t frames_ok;
+            uint32_t frames_error;   // DLC and data errors
+            uint32_t frames_lost;
+            uint32_t rx_missed;
+            uint32_t bus_off;
+            uint32_t ring_drops;
+        } checkpoint;
+    };
+} incident_record_t;
+
+static_assert(sizeof(incident_record_t) == 32, "Incident records should stay compact");
+
+// Parameters of the incident log
+typedef struct {
+    uint32_t batch_records;            // Records per NVS blob
+    uint32_t blocks;                   // Blobs kept, the log holds blocks * batch_records records
+    uint32_t queue_len;                // Records queued until the writer catches up
+    uint32_t flush_interval_ms;        // Time after which a partly filled block is written
+    uint32_t min_write_interval_ms;    // Min. time between two block writes
+    uint32_t frames_per_minute;        // Corrupt frames recorded, the others are only counted
+    uint32_t checkpoint_interval_ms;   // Period of the counter checkpoints, 0 for none
+} incident_log_config_t;
+
+// Open the log in the NVS partition, record the start and run the writer task. With
+// print_stored the records of the previous starts are printed first.
+esp_err_t incident_log_start(const incident_log_config_t *config, bool print_stored,
+                             const char *tag, int core, int priority);
+
+// Queue a record with a value. Never blocks, a record is dropped and counted if the queue is
+// full. Safe to call from any task once the log is started, a no-op before.
+void incident_log_value(incident_type_t type, uint32_t value);
+
+// Queue a record with the ID, flags and data of a frame, see incident_log_value(). Only the
+// first frames_per_minute frames of each minute are recorded, so a burst of corrupt frames does
+// not turn into a burst of flash writes. Must only be called by one task.
+void incident_log_frame(incident_type_t type, const twai_message_t *message);
+
+// Print the stored and the not yet written records
+void incident_log_print(const char *tag);
+
+// Erase all stored and queued records
+esp_err_t incident_log_clear(void);
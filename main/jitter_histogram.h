@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-bucket histogram of inter-arrival times. All storage is part of the object, nothing is
+// allocated when recording. Values beyond the last bucket are counted in an overflow bucket.
+template <uint32_t BucketWidthUs, size_t BucketCount>
+class JitterHistogram {
+    static_assert(BucketWidthUs > 0 && BucketCount > 0, "Histogram needs at least one bucket");
+
+   public:
+    // Record the arrival of a frame at timestamp_us (esp_timer time)
+    void record_arrival(int64_t timestamp_us) {
+        if (last_arrival_us_ >= 0) {
+            add((uint32_t)(timestamp_us - last_arrival_us_));
+        }
+        last_arrival_us_ = timestamp_us;
+    }
+
+    void add(uint32_t delta_us) {
+        size_t index = delta_us / BucketWidthUs;
+        if (index >= BucketCount) {
+            overflow_++;
+        } else {
+            buckets_[index]++;
+        }
+        if (count_ == 0 || delta_us < min_us_) {
+            min_us_ = delta_us;
+        }
+        if (delta_us > max_us_) {
+            max_us_ = delta_us;
+        }
+        sum_us_ += delta_us;
+        count_++;
+    }
+
+    // Upper bound of the bucket containing the given percentile (in 1/1000), e.g. 990 for p99.
+    // Returns max_us() if the percentile lies in the overflow bucket.
+    uint32_t percentile_us(uint32_t permille) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        uint64_t target = ((uint64_t)count_ * permille + 999) / 1000;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BucketCount; ++i) {
+            seen += buckets_[i];
+            if (seen >= target) {
+                return (i + 1) * BucketWidthUs;
+            }
+        }
+        return max_us_;
+    }
+
+    // Clear the statistics but keep the last arrival, so the next delta is not lost
+    void reset() {
+        for (size_t i = 0; i < BucketCount; ++i) {
+            buckets_[i] = 0;
+        }
+        overflow_ = 0;
+        count_ = 0;
+        sum_us_ = 0;
+        min_us_ = 0;
+        max_us_ = 0;
+    }
+
+    uint32_t count() const { return count_; }
+    uint32_t min_us() const { return min_us_; }
+    uint32_t max_us() const { return max_us_; }
+    uint32_t mean_us() const { return count_ ? (uint32_t)(sum_us_ / count_) : 0; }
+    uint32_t overflow() const { return overflow_; }
+    uint32_t bucket(size_t index) const { return buckets_[index]; }
+
+    static constexpr uint32_t bucket_width_us() { return BucketWidthUs; }
+    static constexpr size_t bucket_count() { return BucketCount; }
+
+   private:
+    uint32_t buckets_[BucketCount] = {};
+    uint32_t overflow_ = 0;
+    uint32_t count_ = 0;
+    uint64_t sum_us_ = 0;
+    uint32_t min_us_ = 0;
+    uint32_t max_us_ = 0;
+    int64_t last_arrival_us_ = -1;
+};
@@ -0,0 +1,158 @@
+#include "latency_profiler.h"
+
+#if CONFIG_TWAI_TESTER_PROFILER || CONFIG_TWAI_TESTER_PROFILER_ISR_PROBE
+
+#include "driver/twai.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "jitter_histogram.h"
+
+#define CPU_FREQ_MHZ CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+
+// Gaps in the cycle counter above this are taken as interrupted, the probe loop itself needs
+// a few cycles per iteration
+#define PROBE_GAP_THRESHOLD_CYCLES 40
+
+// The histograms count cycles for the cycle stages and the interrupt gaps, and microseconds for
+// the end to end stage
+typedef JitterHistogram<CONFIG_TWAI_TESTER_PROFILER_BUCKET_CYCLES, 64> cycle_histogram_t;
+
+static void _print_cycles(const char *tag, const char *name, const cycle_histogram_t *cycles) {
+    if (cycles->count() == 0) {
+        return;
+    }
+    const uint32_t p99 = cycles->percentile_us(990);
+    ESP_LOGI(tag,
+             "Profile %s: n: %lu, min: %lu, mean: %lu, p50: %lu, p99: %lu (%lu.%02lu us), max: "
+             "%lu cycles, overflow: %lu",
+             name, cycles->count(), cycles->min_us(), cycles->mean_us(),
+             cycles->percentile_us(500), p99, p99 / CPU_FREQ_MHZ,
+             (p99 % CPU_FREQ_MHZ) * 100 / CPU_FREQ_MHZ, cycles->max_us(), cycles->overflow());
+}
+
+#if CONFIG_TWAI_TESTER_PROFILER
+typedef JitterHistogram<CONFIG_TWAI_TESTER_PROFILER_BUCKET_US, 64> latency_histogram_t;
+
+static const char *const profile_stage_names[] = {"receive", "hand over", "capture", "validate",
+                                                  "end to end"};
+static_assert(sizeof(profile_stage_names) / sizeof(profile_stage_names[0]) ==
+                  PROFILE_STAGE_COUNT,
+              "Stage name missing");
+
+static cycle_histogram_t profile_cycles[PROFILE_STAGE_END_TO_END];
+static latency_histogram_t profile_end_to_end;
+static portMUX_TYPE profile_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void latency_profiler_record(profile_stage_t stage, uint32_t value) {
+    portENTER_CRITICAL(&profile_lock);
+    if (stage == PROFILE_STAGE_END_TO_END) {
+        profile_end_to_end.add(value);
+    } else {
+        profile_cycles[stage].add(value);
+    }
+    portEXIT_CRITICAL(&profile_lock);
+}
+
+void latency_profiler_print(const char *tag) {
+    for (size_t stage = 0; stage < PROFILE_STAGE_END_TO_END; ++stage) {
+        // Copy and restart the distribution, print outside of the critical section
+        portENTER_CRITICAL(&profile_lock);
+        const cycle_histogram_t cycles = profile_cycles[stage];
+        profile_cycles[stage].reset();
+        portEXIT_CRITICAL(&profile_lock);
+        _print_cycles(tag, profile_stage_names[stage], &cycles);
+    }
+
+    portENTER_CRITICAL(&profile_lock);
+    const latency_histogram_t latency = profile_end_to_end;
+    profile_end_to_end.reset();
+    portEXIT_CRITICAL(&profile_lock);
+    if (latency.count() != 0) {
+        ESP_LOGI(tag,
+                 "Profile %s: n: %lu, min: %lu us, mean: %lu us, p50: %lu us, p99: %lu us, max: "
+                 "%lu us, overflow: %lu",
+                 profile_stage_names[PROFILE_STAGE_END_TO_END], latency.count(),
+                 latency.min_us(), latency.mean_us(), latency.percentile_us(500),
+                 latency.percentile_us(990), latency.max_us(), latency.overflow());
+    }
+}
+#endif   // CONFIG_TWAI_TESTER_PROFILER
+
+#if CONFIG_TWAI_TESTER_PROFILER_ISR_PROBE
+// Spin for duration_ms and record every gap in the cycle counter. Yields every 100 ms for a tick,
+// so the idle task can feed the task watchdog, the yield itself is not recorded.
+static uint64_t _probe_gaps(uint32_t duration_ms, cycle_histogram_t *gaps) {
+    uint64_t stolen_cycles = 0;
+    const int64_t end_us = esp_timer_get_time() + duration_ms * 1000LL;
+    int64_t yield_us = esp_timer_get_time() + 100000;
+    uint32_t last = latency_profiler_cycles();
+    while (1) {
+        for (uint32_t i = 0; i < 4096; ++i) {
+            const uint32_t now = latency_profiler_cycles();
+            const uint32_t gap = now - last;
+            last = now;
+            if (gap > PROBE_GAP_THRESHOLD_CYCLES) {
+                gaps->add(gap);
+                stolen_cycles += gap;
+                last = latency_profiler_cycles();   // Do not count the recording
+            }
+        }
+        const int64_t now_us = esp_timer_get_time();
+        if (now_us >= end_us) {
+            return stolen_cycles;
+        }
+        if (now_us >= yield_us) {
+            vTaskDelay(1);
+            yield_us = esp_timer_get_time() + 100000;
+        }
+        last = latency_profiler_cycles();
+    }
+}
+
+void latency_profiler_isr_probe(uint32_t duration_ms, const char *tag) {
+    static cycle_histogram_t idle_gaps;
+    static cycle_histogram_t active_gaps;
+    idle_gaps.reset();
+    active_gaps.reset();
+
+    // Keep the RX task off this core while probing
+    const UBaseType_t priority = uxTaskPriorityGet(NULL);
+    vTaskPrioritySet(NULL, configMAX_PRIORITIES - 1);
+
+    const uint64_t idle_cycles = _probe_gaps(duration_ms, &idle_gaps);
+    esp_err_t res = twai_start();
+    uint64_t active_cycles = 0;
+    uint32_t frames = 0;
+    if (res == ESP_OK) {
+        active_cycles = _probe_gaps(duration_ms, &active_gaps);
+        twai_status_info_t status;
+        if (twai_get_status_info(&status) == ESP_OK) {
+            // The interrupt also handles frames which do not fit into the RX queue
+            frames = status.msgs_to_rx + status.rx_missed_count + status.rx_overrun_count;
+        }
+        twai_stop();
+        twai_clear_receive_queue();
+    }
+    vTaskPrioritySet(NULL, priority);
+    if (res != ESP_OK) {
+        ESP_LOGW(tag, "ISR probe failed: %s", esp_err_to_name(res));
+        return;
+    }
+
+    _print_cycles(tag, "interrupts (driver stopped)", &idle_gaps);
+    _print_cycles(tag, "interrupts (driver started)", &active_gaps);
+    if (frames == 0) {
+        ESP_LOGW(tag, "ISR probe: no frames received on core %d", xPortGetCoreID());
+        return;
+    }
+    const uint64_t extra_cycles = active_cycles > idle_cycles ? active_cycles - idle_cycles : 0;
+    const uint32_t per_frame = extra_cycles / frames;
+    ESP_LOGI(tag, "ISR probe: %lu frames, %lu cycles (%lu.%02lu us) interrupt time per frame",
+             frames, per_frame, per_frame / CPU_FREQ_MHZ,
+             (per_frame % CPU_FREQ_MHZ) * 100 / CPU_FREQ_MHZ);
+}
+#endif   // CONFIG_TWAI_TESTER_PROFILER_ISR_PROBE
+
+#endif   // CONFIG_TWAI_TESTER_PROFILER || CONFIG_TWAI_TESTER_PROFILER_ISR_PROBE
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_cpu.h"
+#include "sdkconfig.h"
+
+// Stages of the receive path. The cycle counter (CCOUNT) of the two cores is not synchronized,
+// so all cycle stages start and end on the same core. Only the end to end stage crosses cores
+// and is measured with esp_timer instead.
+typedef enum {
+    PROFILE_STAGE_RECEIVE,      // twai_receive() call which dequeues a frame (cycles)
+    PROFILE_STAGE_HAND_OVER,    // Pool allocation and ring push (cycles)
+    PROFILE_STAGE_CAPTURE,      // Binary stream and trace recording (cycles)
+    PROFILE_STAGE_VALIDATE,     // Check against the expected frame table (cycles)
+    PROFILE_STAGE_END_TO_END,   // Dequeue until validation completed (us)
+    PROFILE_STAGE_COUNT,
+} profile_stage_t;
+
+static inline uint32_t latency_profiler_cycles(void) { return esp_cpu_get_cycle_count(); }
+
+// Instrumentation points, which compile to nothing unless the profiler is enabled
+#if CONFIG_TWAI_TESTER_PROFILER
+#define LATENCY_PROFILE_BEGIN(start) const uint32_t start = latency_profiler_cycles()
+#define LATENCY_PROFILE_END(stage, start) latency_profiler_record_since(stage, start)
+#define LATENCY_PROFILE_RECORD(stage, value) latency_profiler_record(stage, value)
+#else
+#define LATENCY_PROFILE_BEGIN(start)
+#define LATENCY_PROFILE_END(stage, start)
+#define LATENCY_PROFILE_RECORD(stage, value)
+#endif
+
+// Record the duration of a stage. Safe to call from any task, takes a short spinlock.
+void latency_profiler_record(profile_stage_t stage, uint32_t value);
+
+// Record the cycles elapsed since start_cycles, taken with latency_profiler_cycles() on the same
+// core
+static inline void latency_profiler_record_since(profile_stage_t stage, uint32_t start_cycles) {
+    latency_profiler_record(stage, latency_profiler_cycles() - start_cycles);
+}
+
+// Print and restart the distribution of every stage
+void latency_profiler_print(const char *tag);
+
+// Estimate the TWAI interrupt cost on the calling core. Spins for duration_ms with the driver
+// stopped and again with the driver started, records every gap in the cycle counter as time
+// taken by interrupts, and prints both gap distributions and the additional interrupt time per
+// received frame. Must be called on the ISR core with the driver installed but not started, and
+// the received frames are discarded.
+void latency_profiler_isr_probe(uint32_t duration_ms, const char *tag);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/twai.h"
+#include "esp_timer.h"
+
+// Payload of frames which the tester receives back itself, either self-received or over a second
+// bus: the low 32 bits of the esp_timer time right before twai_transmit() in data[0..3] and a
+// sequence number in data[4..7], both little endian. Sender and receiver share the clock, so the
+// latency needs no external reference.
+#define LOOPBACK_FRAME_DLC 8
+
+static inline void loopback_frame_stamp(twai_message_t *message, uint32_t sequence) {
+    const uint32_t tx_us = esp_timer_get_time();
+    message->data_length_code = LOOPBACK_FRAME_DLC;
+    for (int i = 0; i < 4; ++i) {
+        message->data[i] = tx_us >> (8 * i);
+        message->data[4 + i] = sequence >> (8 * i);
+    }
+}
+
+static inline uint32_t _loopback_frame_read_le32(const uint8_t *data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+// Time from the stamp to rx_timestamp_us, valid below about 71 minutes
+static inline uint32_t loopback_frame_latency_us(const twai_message_t *message,
+                                                 int64_t rx_timestamp_us) {
+    return (uint32_t)rx_timestamp_us - _loopback_frame_read_le32(&message->data[0]);
+}
+
+static inline uint32_t loopback_frame_sequence(const twai_message_t *message) {
+    return _loopback_frame_read_le32(&message->data[4]);
+}
+
+// Loss and order check of the received sequence numbers, only accessed by the receiving task
+typedef struct {
+    uint32_t next;           // Next expected sequence number
+    uint32_t received;
+    uint32_t lost;           // Sequence numbers skipped
+    uint32_t out_of_order;   // Below the expected one, a late frame was counted as lost before
+} loopback_sequence_t;
+
+static inline void loopback_sequence_record(loopback_sequence_t *state, uint32_t sequence) {
+    state->received++;
+    if (sequence < state->next) {
+        state->out_of_order++;
+        return;
+    }
+    state->lost += sequence - state->next;
+    state->next = sequence + 1;
+}
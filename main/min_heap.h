@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary min-heap with preallocated storage. Less(a, b) is true if a has to come out before b.
+// Not thread safe, it is meant to be owned by a single task.
+template <typename T, size_t N, typename Less>
+class MinHeap {
+   public:
+    // Insert a copy of item. Returns false if the heap is full.
+    bool push(const T &item) {
+        if (size_ >= N) {
+            return false;
+        }
+        size_t i = size_++;
+        while (i > 0 && Less()(item, items_[(i - 1) / 2])) {
+            items_[i] = items_[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        items_[i] = item;
+        return true;
+    }
+
+    // Smallest item, the heap must not be empty
+    const T &top() const { return items_[0]; }
+
+    // Remove the smallest item, the heap must not be empty
+    void pop() {
+        const T last = items_[--size_];
+        size_t i = 0;
+        while (2 * i + 1 < size_) {
+            size_t child = 2 * i + 1;
+            if (child + 1 < size_ && Less()(items_[child + 1], items_[child])) {
+                child++;
+            }
+            if (!Less()(items_[child], last)) {
+                break;
+            }
+            items_[i] = items_[child];
+            i = child;
+        }
+        items_[i] = last;
+    }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    static constexpr size_t capacity() { return N; }
+
+   private:
+    T items_[N];
+    size_t size_ = 0;
+};
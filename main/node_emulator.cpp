@@ -0,0 +1,223 @@
+#include "node_emulator.h"
+
+#include <stdio.h>
+
+#include <atomic>
+
+#include "bus_load.h"
+#include "driver_gate.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "min_heap.h"
+#include "tester_stats.h"
+
+#define NODE_MIN_POLL_US 50
+#define NODE_ERROR_RETRY_US (10 * 1000)   // Driver stopped, e.g. bus off
+
+typedef struct {
+    const node_message_t *node;
+    int64_t released_us;   // Release of the instance waiting for the driver, 0 if none
+    std::atomic<bool> triggered;
+    // Only written by the node task
+    std::atomic<uint32_t> sent;
+    std::atomic<uint32_t> deadline_misses;
+    std::atomic<uint32_t> errors;
+    std::atomic<uint32_t> max_queue_latency_us;   // From the release to twai_transmit()
+} node_entry_t;
+
+typedef struct {
+    int64_t due_us;
+    uint32_t index;
+} node_deadline_t;
+
+typedef struct {
+    uint32_t key;   // Arbitration priority
+    uint32_t index;
+} node_ready_t;
+
+struct _node_deadline_less {
+    bool operator()(const node_deadline_t &a, const node_deadline_t &b) const {
+        return a.due_us < b.due_us;
+    }
+};
+
+struct _node_ready_less {
+    bool operator()(const node_ready_t &a, const node_ready_t &b) const {
+        return a.key != b.key ? a.key < b.key : a.index < b.index;
+    }
+};
+
+static node_entry_t node_entries[NODE_EMULATOR_MAX_MESSAGES];
+static size_t node_count;
+static node_emulator_config_t node_config;
+static TaskHandle_t node_task_handle;
+static esp_timer_handle_t node_timer;
+
+// Only accessed by the node task
+static MinHeap<node_deadline_t, NODE_EMULATOR_MAX_MESSAGES, _node_deadline_less> node_deadlines;
+static MinHeap<node_ready_t, NODE_EMULATOR_MAX_MESSAGES, _node_ready_less> node_ready;
+
+static void _node_timer_callback(void *arg) { xTaskNotifyGive(node_task_handle); }
+
+static void _release(uint32_t index, int64_t now_us) {
+    node_entry_t *entry = &node_entries[index];
+    if (entry->released_us != 0) {
+        // The previous instance still waits, only one instance is queued at a time
+        tester_stats_add(&entry->deadline_misses, 1);
+        return;
+    }
+    entry->released_us = now_us;
+    node_ready.push({twai_arbitration_key(&entry->node->message), index});
+}
+
+static void _release_due(int64_t now_us) {
+    while (!node_deadlines.empty() && node_deadlines.top().due_us <= now_us) {
+        node_deadline_t deadline = node_deadlines.top();
+        node_deadlines.pop();
+        _release(deadline.index, now_us);
+
+        // Drift free, periods the task was too late for are misses
+        const uint32_t period_us = node_entries[deadline.index].node->period_us;
+        const uint32_t skipped = (now_us - deadline.due_us) / period_us;
+        if (skipped != 0) {
+            tester_stats_add(&node_entries[deadline.index].deadline_misses, skipped);
+        }
+        deadline.due_us += (int64_t)(skipped + 1) * period_us;
+        node_deadlines.push(deadline);
+    }
+}
+
+static void _release_events(int64_t now_us) {
+    for (size_t i = 0; i < node_count; ++i) {
+        if (node_entries[i].node->period_us == 0 &&
+            node_entries[i].triggered.exchange(false, std::memory_order_relaxed)) {
+            _release(i, now_us);
+        }
+    }
+}
+
+// Hand the highest priority frames to the driver until max_in_flight are queued. Returns the
+// time until the driver queue should be checked again, 0 if there is nothing waiting.
+static uint32_t _fill_driver_queue(int64_t now_us) {
+    if (node_ready.empty()) {
+        return 0;
+    }
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) != ESP_OK) {
+        return NODE_ERROR_RETRY_US;   // Driver not installed
+    }
+    uint32_t in_flight = status.msgs_to_tx;
+    while (in_flight < node_config.max_in_flight && !node_ready.empty()) {
+        node_entry_t *entry = &node_entries[node_ready.top().index];
+        esp_err_t res = twai_transmit(&entry->node->message, 0);
+        if (res == ESP_ERR_TIMEOUT) {
+            break;   // Queue shorter than max_in_flight
+        }
+        if (res != ESP_OK) {
+            tester_stats_add(&entry->errors, 1);
+            return NODE_ERROR_RETRY_US;
+        }
+        tester_stats_add(&entry->sent, 1);
+        tester_stats_max(&entry->max_queue_latency_us, now_us - entry->released_us);
+        entry->released_us = 0;
+        node_ready.pop();
+        in_flight++;
+    }
+    if (node_ready.empty()) {
+        return 0;
+    }
+    // Check again once the frame at the head of the driver queue should be on the bus
+    const twai_message_t *next = &node_entries[node_ready.top().index].node->message;
+    const uint32_t frame_us =
+        (uint64_t)twai_frame_bits(next, false) * 1000000 / node_config.bitrate;
+    return frame_us > NODE_MIN_POLL_US ? frame_us : NODE_MIN_POLL_US;
+}
+
+static void node_task(void *arg) {
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        const int64_t now_us = esp_timer_get_time();
+        _release_due(now_us);
+        _release_events(now_us);
+        uint32_t poll_us = NODE_ERROR_RETRY_US;   // Driver taken by the console
+        if (driver_gate_try_enter()) {
+            poll_us = _fill_driver_queue(now_us);
+            driver_gate_leave();
+        }
+
+        int64_t wake_us = node_deadlines.empty() ? INT64_MAX : node_deadlines.top().due_us;
+        if (poll_us != 0 && now_us + poll_us < wake_us) {
+            wake_us = now_us + poll_us;
+        }
+        if (wake_us != INT64_MAX) {
+            const int64_t delay_us = wake_us - esp_timer_get_time();
+            esp_timer_stop(node_timer);   // Fails if it already expired
+            esp_timer_start_once(node_timer, delay_us > 0 ? delay_us : 0);
+        }
+    }
+}
+
+esp_err_t node_emulator_start(const node_message_t *messages, size_t count,
+                              const node_emulator_config_t *config) {
+    if (node_count != 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (count > NODE_EMULATOR_MAX_MESSAGES || config->max_in_flight == 0 || config->bitrate == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    node_config = *config;
+
+    const int64_t start_us = esp_timer_get_time();
+    for (size_t i = 0; i < count; ++i) {
+        node_entries[i].node = &messages[i];
+        node_entries[i].released_us = 0;
+        if (messages[i].period_us != 0) {
+            node_deadlines.push({start_us + messages[i].period_us, (uint32_t)i});
+        }
+    }
+    node_count = count;
+
+    const esp_timer_create_args_t timer_args = {.callback = _node_timer_callback,
+                                                .arg = NULL,
+                                                .dispatch_method = ESP_TIMER_TASK,
+                                                .name = "tx_node",
+                                                .skip_unhandled_events = true};
+    esp_err_t res = esp_timer_create(&timer_args, &node_timer);
+    if (res != ESP_OK) {
+        return res;
+    }
+    if (xTaskCreatePinnedToCore(node_task, "TWAI_node", 3072, NULL, config->priority,
+                                &node_task_handle, config->core) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotifyGive(node_task_handle);
+    return ESP_OK;
+}
+
+void node_emulator_trigger(size_t index) {
+    if (index >= node_count) {
+        return;
+    }
+    node_entries[index].triggered.store(true, std::memory_order_relaxed);
+    xTaskNotifyGive(node_task_handle);
+}
+
+void node_emulator_print_stats(const char *tag) {
+    const std::memory_order order = std::memory_order_relaxed;
+    for (size_t i = 0; i < node_count; ++i) {
+        const node_entry_t *entry = &node_entries[i];
+        const uint32_t misses = entry->deadline_misses.load(order);
+        char period[24] = "event driven";
+        if (entry->node->period_us != 0) {
+            snprintf(period, sizeof(period), "every %lu us", entry->node->period_us);
+        }
+        ESP_LOG_LEVEL_LOCAL(misses != 0 ? ESP_LOG_WARN : ESP_LOG_INFO, tag,
+                            "TX node 0x%lx %s: sent: %lu, deadline misses: %lu, errors: %lu, max. "
+                            "release to queue: %lu us",
+                            entry->node->message.identifier, period, entry->sent.load(order),
+                            misses, entry->errors.load(order),
+                            entry->max_queue_latency_us.load(order));
+    }
+}
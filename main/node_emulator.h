@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "driver/twai.h"
+#include "esp_err.h"
+
+// Max. messages of the emulated node set, sizes the entries and both min-heaps
+#define NODE_EMULATOR_MAX_MESSAGES 32
+
+// Message of the emulated node set
+typedef struct {
+    twai_message_t message;
+    uint32_t period_us;   // 0 for an event driven message, sent after node_emulator_trigger()
+} node_message_t;
+
+typedef struct {
+    uint32_t max_in_flight;   // Frames kept in the driver TX queue, bounds the priority inversion
+    uint32_t bitrate;         // To poll the driver TX queue about once per frame
+    int core;
+    int priority;
+} node_emulator_config_t;
+
+// Transmit a set of cyclic and event driven messages like a group of nodes. A task releases each
+// cyclic message at its deadline from a min-heap of deadlines, and every released message waits
+// in a second min-heap ordered by arbitration priority. The driver TX queue is a FIFO, so only
+// max_in_flight frames are handed to it at a time, always the highest priority ones, and a frame
+// due later can only be blocked by those. A message which is released again before its previous
+// instance reached the driver counts as deadline miss. The messages must stay valid.
+esp_err_t node_emulator_start(const node_message_t *messages, size_t count,
+                              const node_emulator_config_t *config);
+
+// Release an event driven message, callable from any task
+void node_emulator_trigger(size_t index);
+
+// Print the counters of each message
+void node_emulator_print_stats(const char *tag);
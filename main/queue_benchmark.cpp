@@ -0,0 +1,131 @@
+#include "queue_benchmark.h"
+
+#include "bus_load.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "self_rx_bench.h"
+
+typedef struct {
+    uint32_t depth;
+    uint32_t sent;
+    uint32_t tx_full;   // Frames not sent because the TX queue was full
+    uint32_t received;
+    uint32_t rx_missed;
+    uint32_t peak_msgs_to_rx;
+    uint32_t heap_bytes;   // Heap taken by the driver installation
+} queue_bench_result_t;
+
+// State of a run, the burst fields are only accessed by the transmitting esp_timer callback
+typedef struct {
+    const queue_bench_config_t *config;
+    uint32_t in_burst;
+    int64_t burst_start_us;
+    queue_bench_result_t *result;
+} queue_bench_state_t;
+
+static bool _bench_tx(twai_message_t *message, uint32_t sent, void *arg) {
+    queue_bench_state_t *state = (queue_bench_state_t *)arg;
+    const int64_t now_us = esp_timer_get_time();
+    if (state->config->burst_frames != 0 && state->in_burst >= state->config->burst_frames) {
+        if (now_us - state->burst_start_us < state->config->burst_interval_ms * 1000LL) {
+            return false;   // Pause between bursts
+        }
+        state->in_burst = 0;
+    }
+    if (state->in_burst == 0) {
+        state->burst_start_us = now_us;
+    }
+    state->in_burst++;
+    return true;
+}
+
+static void _bench_frame(const twai_message_t *message, void *arg) {
+    queue_bench_state_t *state = (queue_bench_state_t *)arg;
+    state->result->received++;
+    esp_rom_delay_us(state->config->delay_us);   // Simulated processing
+}
+
+static void _bench_poll(void *arg) {
+    queue_bench_state_t *state = (queue_bench_state_t *)arg;
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) == ESP_OK &&
+        status.msgs_to_rx > state->result->peak_msgs_to_rx) {
+        state->result->peak_msgs_to_rx = status.msgs_to_rx;
+    }
+}
+
+// Install the driver with an RX queue of depth frames, then transmit and receive for
+// duration_ms
+static esp_err_t _bench_run(const twai_general_config_t *g_config,
+                            const twai_timing_config_t *t_config,
+                            const queue_bench_config_t *config, uint32_t depth,
+                            queue_bench_result_t *result) {
+    *result = {};
+    result->depth = depth;
+    queue_bench_state_t state = {};
+    state.config = config;
+    state.result = result;
+    const self_rx_bench_config_t bench = {.name = "queue_bench",
+                                          .rx_queue_len = depth,
+                                          .alerts_enabled = TWAI_ALERT_NONE,
+                                          .data_length_code = 8,
+                                          .period_us = 1000000 / config->rate,
+                                          .duration_ms = config->duration_ms,
+                                          .settle_ms = 0,
+                                          .on_tx = _bench_tx,
+                                          .on_frame = _bench_frame,
+                                          .on_poll = _bench_poll,
+                                          .on_start = NULL,
+                                          .on_stop = NULL,
+                                          .arg = &state};
+    self_rx_bench_result_t bench_result;
+    esp_err_t res = self_rx_bench_run(g_config, t_config, &bench, &bench_result);
+    result->sent = bench_result.sent;
+    result->tx_full = bench_result.tx_rejected;
+    result->rx_missed = bench_result.status.rx_missed_count;
+    result->heap_bytes = bench_result.heap_bytes;
+    return res;
+}
+
+void queue_depth_benchmark(const twai_general_config_t *g_config,
+                           const twai_timing_config_t *t_config,
+                           const queue_bench_config_t *config, const char *tag) {
+    twai_message_t frame = {};
+    frame.data_length_code = 8;
+    const uint32_t max_rate = twai_max_frame_rate(twai_timing_bitrate(t_config),
+                                                  twai_frame_bits(&frame, false));
+    ESP_LOGI(tag,
+             "Queue bench: %lu frames/s (bus max. %lu), burst: %lu frames every %lu ms, "
+             "processing: %lu us/frame, %lu ms per run",
+             config->rate, max_rate, config->burst_frames, config->burst_interval_ms,
+             config->delay_us, config->duration_ms);
+
+    uint32_t smallest_lossless = 0;
+    for (uint32_t depth = config->first_depth; depth <= config->last_depth; depth *= 2) {
+        queue_bench_result_t result;
+        esp_err_t res = _bench_run(g_config, t_config, config, depth, &result);
+        if (res != ESP_OK) {
+            ESP_LOGW(tag, "Queue bench failed at depth %lu: %s", depth, esp_err_to_name(res));
+            return;
+        }
+        ESP_LOG_LEVEL_LOCAL(result.rx_missed != 0 ? ESP_LOG_WARN : ESP_LOG_INFO, tag,
+                            "Queue bench depth %3lu: sent: %lu, tx full: %lu, received: %lu, rx "
+                            "missed: %lu, peak msgs_to_rx: %lu, heap: %lu bytes (%lu for the "
+                            "RX queue items)",
+                            depth, result.sent, result.tx_full, result.received,
+                            result.rx_missed, result.peak_msgs_to_rx, result.heap_bytes,
+                            depth * (uint32_t)sizeof(twai_message_t));
+        if (result.rx_missed == 0 && smallest_lossless == 0) {
+            smallest_lossless = depth;
+        }
+    }
+
+    if (smallest_lossless != 0) {
+        ESP_LOGI(tag, "Queue bench: smallest RX queue without missed frames: %lu",
+                 smallest_lossless);
+    } else {
+        ESP_LOGW(tag, "Queue bench: frames were missed with every RX queue length");
+    }
+}
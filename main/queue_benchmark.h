@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/twai.h"
+
+// Load profile of the driver queue benchmark
+typedef struct {
+    uint32_t first_depth;         // RX queue length of the first run, doubled for each next run
+    uint32_t last_depth;          // RX queue length of the last run
+    uint32_t rate;                // Transmitted frames per second while a burst is active
+    uint32_t burst_frames;        // Frames per burst, 0 to transmit continuously
+    uint32_t burst_interval_ms;   // Time from the start of one burst to the next
+    uint32_t delay_us;            // Busy processing time for each received frame
+    uint32_t duration_ms;         // Duration of each run
+} queue_bench_config_t;
+
+// Sweep the RX queue length from first_depth to last_depth. Each run installs the driver in
+// no-ACK mode, receives its own frames sent with the given rate and bursts, and handles each one
+// with delay_us processing time. Prints the missed frames, the peak queue fill level and the heap
+// taken by the driver for each depth. The frames are self-received, so a transceiver or a
+// TX-RX jumper is needed, and they are visible to other nodes on the bus.
+// Must be called while the driver is not installed.
+void queue_depth_benchmark(const twai_general_config_t *g_config,
+                           const twai_timing_config_t *t_config,
+                           const queue_bench_config_t *config, const char *tag);
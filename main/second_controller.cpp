@@ -0,0 +1,208 @@
+#include "second_controller.h"
+
+#include "soc/soc_caps.h"
+
+#if SOC_TWAI_CONTROLLER_NUM > 1
+
+#include "driver_gate.h"
+#include "e2e_protection.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "expected_frames.h"
+#include "loopback_frame.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define SECOND_CONTROLLER_ID 1
+#define SECOND_ALERTS (TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED)
+
+// Counters of the second controller, only accessed by its task
+typedef struct {
+    uint32_t sent;
+    uint32_t tx_full;   // Frames not queued because the TX queue was full
+    uint32_t received;
+    uint32_t forwarded;
+    uint32_t forward_drops;   // Frames not queued on controller 0
+    uint32_t bus_off;
+} second_stats_t;
+
+static struct {
+    second_controller_config_t config;
+    const twai_timing_config_t *t_config;
+    uint32_t report_interval_ms;
+    const char *tag;
+    twai_handle_t handle;
+    SemaphoreHandle_t started;
+    esp_err_t start_result;
+    second_stats_t stats;
+} second;
+
+static void _queue_frame(const twai_message_t *message) {
+    if (twai_transmit_v2(second.handle, message, 0) == ESP_OK) {
+        second.stats.sent++;
+    } else {
+        second.stats.tx_full++;
+    }
+}
+
+static void _send_probe(uint32_t sequence) {
+    twai_message_t probe = {};
+    probe.identifier = second.config.probe_id;
+    loopback_frame_stamp(&probe, sequence);
+    _queue_frame(&probe);
+}
+
+// Queue every cyclic expected frame and the probe whose period boundary was crossed between
+// last_ms and now_ms. Works with any tick period, the cycle times are rounded up to it.
+static void _send_due_frames(uint32_t last_ms, uint32_t now_ms) {
+    for (size_t i = 0; i < expected_frame_count(); ++i) {
+        const expected_frame_t *expected = expected_frame_at(i);
+        const uint32_t cycle_ms = expected->cycle_time_ms;
+        if (cycle_ms == 0 || now_ms / cycle_ms == last_ms / cycle_ms) {
+            continue;
+        }
+        twai_message_t message = {};
+        message.extd = expected->extd;
+        message.identifier = expected->identifier;
+        message.data_length_code = expected->dlc;
+        for (size_t b = 0; b < TWAI_FRAME_MAX_DLC; ++b) {
+            message.data[b] = expected->data[b];
+        }
+        if (expected->e2e) {
+            // The counter follows the cycle number, so a cycle skipped here shows up as loss
+            e2e_protect(expected->e2e_data_id, (now_ms / cycle_ms) % (E2E_COUNTER_MAX + 1),
+                        message.data, message.data_length_code);
+        }
+        _queue_frame(&message);
+    }
+    const uint32_t probe_ms = second.config.probe_period_ms;
+    if (probe_ms != 0 && now_ms / probe_ms != last_ms / probe_ms) {
+        _send_probe(now_ms / probe_ms);
+    }
+}
+
+// Pass all frames received on the second bus to controller 0, waiting at most wait for the first
+static void _forward_frames(TickType_t wait) {
+    twai_message_t message;
+    while (twai_receive_v2(second.handle, &message, wait) == ESP_OK) {
+        second.stats.received++;
+        bool forwarded = false;
+        if (driver_gate_try_enter()) {   // Not while the console reinstalls controller 0
+            forwarded = twai_transmit(&message, 0) == ESP_OK;
+            driver_gate_leave();
+        }
+        if (forwarded) {
+            second.stats.forwarded++;
+        } else {
+            second.stats.forward_drops++;
+        }
+        wait = 0;
+    }
+}
+
+// Recover from bus off right away, the bus of a second controller is a test bench bus
+static void _handle_alerts(void) {
+    uint32_t alerts = 0;
+    if (twai_read_alerts_v2(second.handle, &alerts, 0) != ESP_OK) {
+        return;
+    }
+    if (alerts & TWAI_ALERT_BUS_OFF) {
+        second.stats.bus_off++;
+        ESP_LOGW(second.tag, "Controller 1 bus off, initiating recovery");
+        twai_initiate_recovery_v2(second.handle);
+    }
+    if (alerts & TWAI_ALERT_BUS_RECOVERED) {
+        ESP_LOGI(second.tag, "Controller 1 recovered");
+        twai_start_v2(second.handle);
+    }
+}
+
+static void _print_stats(const second_stats_t *now, const second_stats_t *last) {
+    ESP_LOGI(second.tag,
+             "Controller 1: sent: %lu (+%lu), tx full: %lu, received: %lu (+%lu), forwarded: "
+             "%lu, forward drops: %lu, bus off: %lu",
+             now->sent, now->sent - last->sent, now->tx_full, now->received,
+             now->received - last->received, now->forwarded, now->forward_drops, now->bus_off);
+}
+
+// Install the driver on the task's core, so the interrupt is allocated there as well
+static esp_err_t _install(void) {
+    const twai_general_config_t g_config = {.controller_id = SECOND_CONTROLLER_ID,
+                                            .mode = TWAI_MODE_NORMAL,
+                                            .tx_io = second.config.tx_gpio,
+                                            .rx_io = second.config.rx_gpio,
+                                            .clkout_io = TWAI_IO_UNUSED,
+                                            .bus_off_io = TWAI_IO_UNUSED,
+                                            .tx_queue_len = second.config.tx_queue_len,
+                                            .rx_queue_len = second.config.rx_queue_len,
+                                            .alerts_enabled = SECOND_ALERTS,
+                                            .clkout_divider = 0,
+                                            .intr_flags = ESP_INTR_FLAG_LEVEL1};
+    const twai_filter_config_t accept_all = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    esp_err_t res = twai_driver_install_v2(&g_config, second.t_config, &accept_all, &second.handle);
+    if (res != ESP_OK) {
+        return res;
+    }
+    res = twai_start_v2(second.handle);
+    if (res != ESP_OK) {
+        twai_driver_uninstall_v2(second.handle);
+    }
+    return res;
+}
+
+static void second_task(void *arg) {
+    second.start_result = _install();
+    xSemaphoreGive(second.started);
+    if (second.start_result != ESP_OK) {
+        vTaskDelete(NULL);
+    }
+
+    // At least one tick per iteration, even if the tick period is longer than 1 ms
+    const TickType_t period = pdMS_TO_TICKS(1) > 0 ? pdMS_TO_TICKS(1) : 1;
+    second_stats_t reported = {};
+    TickType_t last_wake = xTaskGetTickCount();
+    TickType_t last_report = last_wake;
+    uint32_t last_ms = 0;
+    while (1) {
+        if (second.config.role == SECOND_CONTROLLER_LOAD) {
+            vTaskDelayUntil(&last_wake, period);
+            const uint32_t now_ms = esp_timer_get_time() / 1000;
+            _send_due_frames(last_ms, now_ms);
+            last_ms = now_ms;
+        } else {
+            _forward_frames(pdMS_TO_TICKS(10));
+        }
+        _handle_alerts();
+
+        const TickType_t now = xTaskGetTickCount();
+        if (now - last_report >= pdMS_TO_TICKS(second.report_interval_ms)) {
+            _print_stats(&second.stats, &reported);
+            reported = second.stats;
+            last_report = now;
+        }
+    }
+}
+
+esp_err_t second_controller_start(const twai_timing_config_t *t_config,
+                                  const second_controller_config_t *config,
+                                  uint32_t report_interval_ms, const char *tag) {
+    second.config = *config;
+    second.t_config = t_config;
+    second.report_interval_ms = report_interval_ms;
+    second.tag = tag;
+    second.started = xSemaphoreCreateBinary();
+    if (second.started == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(second_task, "TWAI1", 4096, NULL, config->priority, NULL,
+                                config->core) != pdPASS) {
+        vSemaphoreDelete(second.started);
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(second.started, portMAX_DELAY);
+    vSemaphoreDelete(second.started);
+    return second.start_result;
+}
+
+#endif   // SOC_TWAI_CONTROLLER_NUM > 1
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/gpio.h"
+#include "driver/twai.h"
+#include "esp_err.h"
+#include "loopback_frame.h"
+
+// Use of the second TWAI controller on targets with SOC_TWAI_CONTROLLER_NUM > 1. It runs on its
+// own bus through the handle based twai_*_v2 API, while the tester keeps using the legacy API
+// for controller 0.
+typedef enum {
+    // Transmit the cyclic frames of the expected frame table and the loopback probe, so a board
+    // with both buses wired together is its own reference node
+    SECOND_CONTROLLER_LOAD,
+    // Forward every frame received on the second bus to the bus of controller 0
+    SECOND_CONTROLLER_GATEWAY,
+} second_controller_role_t;
+
+typedef struct {
+    second_controller_role_t role;
+    gpio_num_t tx_gpio;
+    gpio_num_t rx_gpio;
+    uint32_t tx_queue_len;
+    uint32_t rx_queue_len;
+    uint32_t probe_id;          // Standard ID of the loopback probe
+    uint32_t probe_period_ms;   // 0 to send no probes
+    int core;                   // Core of the task and of the controller's interrupt
+    int priority;
+} second_controller_config_t;
+
+// Loopback probe as transmitted by the load role, a loopback frame with a standard ID. The
+// receiver gets the latency from queueing on one controller to the dequeue on the other.
+static inline bool second_controller_probe_latency(const twai_message_t *message,
+                                                   uint32_t probe_id, int64_t rx_timestamp_us,
+                                                   uint32_t *latency_us) {
+    if (message->identifier != probe_id || message->extd ||
+        message->data_length_code != LOOPBACK_FRAME_DLC) {
+        return false;
+    }
+    *latency_us = loopback_frame_latency_us(message, rx_timestamp_us);
+    return true;
+}
+
+// Install and start the second controller with the timing of the first one and the accept all
+// filter, then run the role in a task pinned to config->core. The interrupt is allocated on the
+// same core. Once per report_interval_ms the sent, received and forwarded frames are printed.
+esp_err_t second_controller_start(const twai_timing_config_t *t_config,
+                                  const second_controller_config_t *config,
+                                  uint32_t report_interval_ms, const char *tag);
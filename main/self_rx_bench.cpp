@@ -0,0 +1,127 @@
+#include "self_rx_bench.h"
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+// State of the transmitting esp_timer callback
+typedef struct {
+    const self_rx_bench_config_t *config;
+    twai_message_t message;
+    uint32_t sent;
+    uint32_t rejected;
+} self_rx_bench_tx_t;
+
+static void _tx_callback(void *arg) {
+    self_rx_bench_tx_t *tx = (self_rx_bench_tx_t *)arg;
+    if (tx->config->on_tx != NULL && !tx->config->on_tx(&tx->message, tx->sent, tx->config->arg)) {
+        return;
+    }
+    if (twai_transmit(&tx->message, 0) == ESP_OK) {
+        tx->sent++;
+    } else {
+        tx->rejected++;
+    }
+}
+
+static void _receive(const self_rx_bench_config_t *config, int64_t end_us) {
+    twai_message_t message;
+    while (esp_timer_get_time() < end_us) {
+        if (twai_receive(&message, pdMS_TO_TICKS(10)) == ESP_OK) {
+            config->on_frame(&message, config->arg);
+        }
+        if (config->on_poll != NULL) {
+            config->on_poll(config->arg);
+        }
+    }
+}
+
+// Keep receiving until a pending bus off recovery completed, the driver can only be uninstalled
+// while stopped or bus off
+static void _settle(const self_rx_bench_config_t *config) {
+    const int64_t end_us = esp_timer_get_time() + config->settle_ms * 1000LL;
+    twai_status_info_t status;
+    while (esp_timer_get_time() < end_us && twai_get_status_info(&status) == ESP_OK &&
+           status.state != TWAI_STATE_RUNNING) {
+        _receive(config, esp_timer_get_time() + 10 * 1000);
+    }
+}
+
+static void _stop_tx(esp_timer_handle_t timer) {
+    if (timer != NULL) {
+        esp_timer_stop(timer);
+        esp_timer_delete(timer);
+    }
+}
+
+esp_err_t self_rx_bench_run(const twai_general_config_t *g_config,
+                            const twai_timing_config_t *t_config,
+                            const self_rx_bench_config_t *config, self_rx_bench_result_t *result) {
+    twai_general_config_t general = *g_config;
+    general.mode = TWAI_MODE_NO_ACK;
+    general.alerts_enabled = config->alerts_enabled;
+    if (config->rx_queue_len != 0) {
+        general.rx_queue_len = config->rx_queue_len;
+    }
+    const twai_filter_config_t accept_all = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+
+    *result = {};
+    const size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    esp_err_t res = twai_driver_install(&general, t_config, &accept_all);
+    if (res != ESP_OK) {
+        return res;
+    }
+    result->heap_bytes = heap_before - heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    res = twai_start();
+    if (res != ESP_OK) {
+        twai_driver_uninstall();
+        return res;
+    }
+
+    self_rx_bench_tx_t tx = {};
+    tx.config = config;
+    tx.message.self = 1;
+    tx.message.identifier = 0x7FF;
+    tx.message.data_length_code = config->data_length_code;
+    esp_timer_handle_t timer = NULL;
+    if (config->period_us != 0) {
+        const esp_timer_create_args_t timer_args = {.callback = _tx_callback,
+                                                    .arg = &tx,
+                                                    .dispatch_method = ESP_TIMER_TASK,
+                                                    .name = config->name,
+                                                    .skip_unhandled_events = true};
+        res = esp_timer_create(&timer_args, &timer);
+        if (res == ESP_OK) {
+            res = esp_timer_start_periodic(timer, config->period_us);
+        } else {
+            timer = NULL;
+        }
+    }
+    if (res == ESP_OK && config->on_start != NULL) {
+        res = config->on_start(config->arg);
+    }
+    if (res != ESP_OK) {
+        _stop_tx(timer);
+        twai_stop();
+        twai_driver_uninstall();
+        return res;
+    }
+
+    const int64_t start_us = esp_timer_get_time();
+    _receive(config, start_us + config->duration_ms * 1000LL);
+    if (config->on_stop != NULL) {
+        config->on_stop(config->arg);
+    }
+    if (config->settle_ms != 0) {
+        _settle(config);
+    }
+    result->elapsed_us = esp_timer_get_time() - start_us;
+
+    _stop_tx(timer);
+    twai_get_status_info(&result->status);
+    result->sent = tx.sent;
+    result->tx_rejected = tx.rejected;
+
+    twai_stop();
+    return twai_driver_uninstall();
+}
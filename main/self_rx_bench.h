@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/twai.h"
+#include "esp_err.h"
+
+// Prepares the next frame in the esp_timer task, sent is the number of frames queued so far.
+// Returns false to skip this period.
+typedef bool (*self_rx_bench_tx_cb_t)(twai_message_t *message, uint32_t sent, void *arg);
+// Handles a received own frame in the calling task
+typedef void (*self_rx_bench_frame_cb_t)(const twai_message_t *message, void *arg);
+// Called in the calling task
+typedef void (*self_rx_bench_cb_t)(void *arg);
+typedef esp_err_t (*self_rx_bench_start_cb_t)(void *arg);
+
+// One self-reception benchmark run
+typedef struct {
+    const char *name;                    // Name of the transmitting esp_timer
+    uint32_t rx_queue_len;               // RX queue length, 0 keeps the one of g_config
+    uint32_t alerts_enabled;             // Alerts to enable, read by on_poll
+    uint8_t data_length_code;            // Length of the transmitted frames
+    uint32_t period_us;                  // TX period, 0 to transmit nothing
+    uint32_t duration_ms;                // Receive time
+    uint32_t settle_ms;                  // Max. wait for a bus off recovery after the receive time
+    self_rx_bench_tx_cb_t on_tx;         // Optional, the frames are sent unchanged without it
+    self_rx_bench_frame_cb_t on_frame;   // Per-frame handler
+    self_rx_bench_cb_t on_poll;          // Optional, after each receive attempt
+    self_rx_bench_start_cb_t on_start;   // Optional, when the TX runs, before the receive time
+    self_rx_bench_cb_t on_stop;          // Optional, after the receive time, before the settle
+    void *arg;                           // Passed to the callbacks
+} self_rx_bench_config_t;
+
+typedef struct {
+    uint32_t sent;
+    uint32_t tx_rejected;        // Frames not queued, TX queue full or bus off
+    uint32_t elapsed_us;         // Receive time including the settle time
+    uint32_t heap_bytes;         // Heap taken by the driver installation
+    twai_status_info_t status;   // Driver status at the end of the run
+} self_rx_bench_result_t;
+
+// Install the driver in no-ACK mode with an accept-all filter, transmit own frames with ID 0x7FF
+// every period_us from an esp_timer and hand each received one to on_frame for duration_ms.
+// Then wait up to settle_ms until a bus off recovery completed, stop the TX and uninstall the
+// driver. The frames are self-received, so a transceiver or a TX-RX jumper is needed, and they
+// are visible to other nodes on the bus. Must be called while the driver is not installed.
+esp_err_t self_rx_bench_run(const twai_general_config_t *g_config,
+                            const twai_timing_config_t *t_config,
+                            const self_rx_bench_config_t *config, self_rx_bench_result_t *result);
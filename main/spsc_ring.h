@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// Lock-free single-producer/single-consumer ring buffer with preallocated storage.
+// push() must only be called from one task and pop()/pop_batch() only from one other task.
+// No FreeRTOS queue, mutex or critical section is involved, the indices are synchronized with
+// acquire/release atomics only.
+template <typename T, size_t N>
+class SpscRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "Ring size must be a power of two");
+
+   public:
+    // Producer: Copy item into the ring. Returns false if the ring is full.
+    bool push(const T &item) {
+        const uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= N) {
+            return false;
+        }
+        buffer_[head & kMask] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: Copy the oldest item out of the ring. Returns false if the ring is empty.
+    bool pop(T *item) { return pop_batch(item, 1) == 1; }
+
+    // Consumer: Copy up to max_count items out of the ring and return the number copied.
+    size_t pop_batch(T *items, size_t max_count) {
+        const uint32_t tail = tail_.load(std::memory_order_relaxed);
+        uint32_t available = head_.load(std::memory_order_acquire) - tail;
+        if (available > max_count) {
+            available = max_count;
+        }
+        for (uint32_t i = 0; i < available; ++i) {
+            items[i] = buffer_[(tail + i) & kMask];
+        }
+        tail_.store(tail + available, std::memory_order_release);
+        return available;
+    }
+
+    // Number of items currently stored. Only a snapshot when called concurrently.
+    size_t size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() { return N; }
+
+   private:
+    static constexpr uint32_t kMask = N - 1;
+
+    std::atomic<uint32_t> head_{0};   // Written by the producer only
+    std::atomic<uint32_t> tail_{0};   // Written by the consumer only
+    T buffer_[N];
+};
@@ -0,0 +1,108 @@
+#include "task_monitor.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu_usage.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Tasks whose run time counters are kept for the next report
+#define MONITOR_MAX_TASKS 24
+
+typedef struct {
+    TaskHandle_t handle;
+    uint32_t run_time;
+} monitor_counter_t;
+
+static task_monitor_config_t monitor_config;
+static const char *monitor_tag;
+
+static monitor_counter_t last_counters[MONITOR_MAX_TASKS];
+static UBaseType_t last_count;
+static cpu_usage_sample_t last_sample;
+
+static int _compare_name(const void *a, const void *b) {
+    return strcmp(((const TaskStatus_t *)a)->pcTaskName, ((const TaskStatus_t *)b)->pcTaskName);
+}
+
+// Run time counter of the task at the last report, 0 if it did not exist then
+static uint32_t _last_run_time(TaskHandle_t handle) {
+    for (UBaseType_t i = 0; i < last_count; ++i) {
+        if (last_counters[i].handle == handle) {
+            return last_counters[i].run_time;
+        }
+    }
+    return 0;
+}
+
+static void _print_tasks(void) {
+    cpu_usage_snapshot_t snapshot;
+    cpu_usage_snapshot(&snapshot);
+    if (snapshot.tasks == NULL) {
+        ESP_LOGW(monitor_tag, "Task monitor: no memory for the task states");
+        return;
+    }
+    qsort(snapshot.tasks, snapshot.count, sizeof(TaskStatus_t), _compare_name);
+
+    UBaseType_t kept = 0;
+    monitor_counter_t counters[MONITOR_MAX_TASKS];
+    for (UBaseType_t i = 0; i < snapshot.count; ++i) {
+        const TaskStatus_t *state = &snapshot.tasks[i];
+        if (strncmp(state->pcTaskName, monitor_config.name_prefix,
+                    strlen(monitor_config.name_prefix)) != 0) {
+            continue;
+        }
+        const uint32_t permille =
+            cpu_usage_task_permille(&last_sample, &snapshot.sample,
+                                    _last_run_time(state->xHandle), state->ulRunTimeCounter);
+        const BaseType_t core = xTaskGetCoreID(state->xHandle);
+        // The ESP-IDF port counts the stack in bytes
+        const uint32_t stack_free = state->usStackHighWaterMark;
+        ESP_LOGI(monitor_tag, "Task %-16s core %c, prio %2u: CPU %3lu.%lu%%, stack min. free %lu",
+                 state->pcTaskName, core == tskNO_AFFINITY ? '-' : (char)('0' + core),
+                 state->uxCurrentPriority, permille / 10, permille % 10, stack_free);
+        if (stack_free < monitor_config.stack_warn_bytes) {
+            ESP_LOGW(monitor_tag, "Task %s: only %lu bytes of its stack were never used",
+                     state->pcTaskName, stack_free);
+        }
+        if (kept < MONITOR_MAX_TASKS) {
+            counters[kept++] = {state->xHandle, state->ulRunTimeCounter};
+        }
+    }
+
+    memcpy(last_counters, counters, kept * sizeof(monitor_counter_t));
+    last_count = kept;
+    last_sample = snapshot.sample;
+    cpu_usage_snapshot_free(&snapshot);
+}
+
+static void _print_heap(void) {
+    ESP_LOGI(monitor_tag, "Heap: free %u (internal %u), min. free %u, largest block %u",
+             heap_caps_get_free_size(MALLOC_CAP_DEFAULT),
+             heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+             heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT),
+             heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+}
+
+static void monitor_task(void *arg) {
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(monitor_config.interval_ms));
+        _print_tasks();
+        _print_heap();
+    }
+}
+
+esp_err_t task_monitor_start(const task_monitor_config_t *config, const char *tag, int core,
+                             int priority) {
+    monitor_config = *config;
+    monitor_tag = tag;
+    if (xTaskCreatePinnedToCore(monitor_task, "TWAI_monitor", 3072, NULL, priority, NULL, core) !=
+        pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
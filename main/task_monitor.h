@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Parameters of the task monitor
+typedef struct {
+    uint32_t interval_ms;        // Report interval
+    const char *name_prefix;     // Only tasks whose name starts with it are reported
+    uint32_t stack_warn_bytes;   // Warn once the unused stack of a task drops below it
+} task_monitor_config_t;
+
+// Start a task which prints the CPU share, the stack high water mark and the core of the
+// monitored tasks and the heap usage once per interval. The CPU share is the part of one core a
+// task took since the last report, taken from the FreeRTOS run time statistics.
+esp_err_t task_monitor_start(const task_monitor_config_t *config, const char *tag, int core,
+                             int priority);
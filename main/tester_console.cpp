@@ -0,0 +1,486 @@
+#include "tester_console.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "bus_load.h"
+#include "driver_gate.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "incident_log.h"
+#include "loopback_frame.h"
+#include "sdkconfig.h"
+#include "tester_stats.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+static const twai_timing_config_t console_timings[] = {
+    TWAI_TIMING_CONFIG_25KBITS(),  TWAI_TIMING_CONFIG_50KBITS(),  TWAI_TIMING_CONFIG_100KBITS(),
+    TWAI_TIMING_CONFIG_125KBITS(), TWAI_TIMING_CONFIG_250KBITS(), TWAI_TIMING_CONFIG_500KBITS(),
+    TWAI_TIMING_CONFIG_800KBITS(), TWAI_TIMING_CONFIG_1MBITS(),
+};
+#pragma GCC diagnostic pop
+
+static const char *const mode_names[] = {"normal", "no_ack", "listen"};
+
+static const char *console_tag;
+static tester_console_config_t console_config;   // Edited by the commands, only the REPL task
+
+// Load generator, stopped by the REPL task with load_stop. It clears load_active on exit.
+static std::atomic<bool> load_stop;
+static std::atomic<bool> load_active;
+static twai_message_t load_message;
+static uint32_t load_period_ms;
+
+static bool _parse_u32(const char *text, uint32_t *value) {
+    char *end;
+    *value = strtoul(text, &end, 0);
+    return *text != '\0' && *end == '\0';
+}
+
+static int _usage(const char *usage) {
+    printf("Usage: %s\n", usage);
+    return 1;
+}
+
+static int _result(const char *action, esp_err_t res) {
+    if (res != ESP_OK) {
+        printf("%s failed: %s\n", action, esp_err_to_name(res));
+        return 1;
+    }
+    return 0;
+}
+
+static void _print_config(void) {
+    const tester_console_config_t *c = &console_config;
+    const uint32_t sample_point = twai_timing_sample_point_permille(&c->t_config);
+    printf("mode: %s, tx gpio: %d, rx gpio: %d, tx queue: %lu, rx queue: %lu\n",
+           mode_names[c->g_config.mode], c->g_config.tx_io, c->g_config.rx_io,
+           c->g_config.tx_queue_len, c->g_config.rx_queue_len);
+    printf("bitrate: %lu bit/s, brp: %lu, tseg1: %u, tseg2: %u, sjw: %u, sample point: "
+           "%lu.%lu%%%s\n",
+           twai_timing_bitrate(&c->t_config), c->t_config.brp, c->t_config.tseg_1,
+           c->t_config.tseg_2, c->t_config.sjw, sample_point / 10, sample_point % 10,
+           c->t_config.triple_sampling ? ", triple sampling" : "");
+    printf("filter: %s, code: 0x%08lx, mask: 0x%08lx\n",
+           c->f_config.single_filter ? "single" : "dual", c->f_config.acceptance_code,
+           c->f_config.acceptance_mask);
+}
+
+typedef struct {
+    esp_err_t result;
+    SemaphoreHandle_t done;
+} install_job_t;
+
+// The driver allocates its interrupt on the calling core
+static void _install_task(void *arg) {
+    install_job_t *job = (install_job_t *)arg;
+    job->result = twai_driver_install(&console_config.g_config, &console_config.t_config,
+                                      &console_config.f_config);
+    xSemaphoreGive(job->done);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t _install(void) {
+    install_job_t job = {.result = ESP_FAIL, .done = xSemaphoreCreateBinary()};
+    if (job.done == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(_install_task, "TWAI_install", 4096, &job, 20, NULL,
+                                console_config.isr_core) != pdPASS) {
+        vSemaphoreDelete(job.done);
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(job.done, portMAX_DELAY);
+    vSemaphoreDelete(job.done);
+    return job.result;
+}
+
+static void _print_status(void) {
+    if (driver_gate_is_closed()) {
+        printf("tester tasks parked until driver start\n");
+    }
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) != ESP_OK) {
+        printf("driver not installed\n");
+        return;
+    }
+    printf("state: %d, to tx: %lu, to rx: %lu, TEC: %lu, REC: %lu, tx failed: %lu, rx missed: "
+           "%lu, rx overrun: %lu, arb lost: %lu, bus errors: %lu\n",
+           status.state, status.msgs_to_tx, status.msgs_to_rx, status.tx_error_counter,
+           status.rx_error_counter, status.tx_failed_count, status.rx_missed_count,
+           status.rx_overrun_count, status.arb_lost_count, status.bus_error_count);
+}
+
+// Park the tasks using the driver before it is stopped or uninstalled. They stay parked until
+// the driver is started again.
+static esp_err_t _take_driver(void) {
+    esp_err_t res = driver_gate_close(pdMS_TO_TICKS(2 * DRIVER_GATE_MAX_HOLD_MS));
+    if (res == ESP_ERR_TIMEOUT) {
+        printf("tasks did not leave the driver in time\n");
+    }
+    return res;
+}
+
+static esp_err_t _start(void) {
+    esp_err_t res = twai_start();
+    if (res == ESP_OK) {
+        driver_gate_open();
+    }
+    return res;
+}
+
+static esp_err_t _stop(void) {
+    esp_err_t res = _take_driver();
+    if (res == ESP_OK) {
+        res = twai_stop();
+    }
+    return res;
+}
+
+static esp_err_t _uninstall(void) {
+    esp_err_t res = _take_driver();
+    if (res == ESP_OK) {
+        res = twai_driver_uninstall();
+    }
+    return res;
+}
+
+// Stop and uninstall the driver, install it with the edited configuration and start it again
+static esp_err_t _restart(void) {
+    const int64_t start_us = esp_timer_get_time();
+    esp_err_t res = _take_driver();
+    twai_status_info_t status;
+    if (res == ESP_OK && twai_get_status_info(&status) == ESP_OK) {
+        if (status.state == TWAI_STATE_RUNNING) {
+            res = twai_stop();
+        }
+        if (res == ESP_OK) {
+            res = twai_driver_uninstall();
+        }
+    }
+    if (res == ESP_OK) {
+        res = _install();
+    }
+    if (res == ESP_OK) {
+        res = _start();
+    }
+    if (res == ESP_OK) {
+        printf("driver restarted in %lu us\n", (uint32_t)(esp_timer_get_time() - start_us));
+    }
+    return res;
+}
+
+static int _cmd_driver(int argc, char **argv) {
+    const char *usage = "driver <start|stop|install|uninstall|restart|status>";
+    if (argc != 2) {
+        return _usage(usage);
+    }
+    const char *action = argv[1];
+    if (strcmp(action, "start") == 0) {
+        return _result(action, _start());
+    } else if (strcmp(action, "stop") == 0) {
+        return _result(action, _stop());
+    } else if (strcmp(action, "install") == 0) {
+        return _result(action, _install());
+    } else if (strcmp(action, "uninstall") == 0) {
+        return _result(action, _uninstall());
+    } else if (strcmp(action, "restart") == 0) {
+        return _result(action, _restart());
+    } else if (strcmp(action, "status") == 0) {
+        _print_status();
+        return 0;
+    }
+    return _usage(usage);
+}
+
+static int _cmd_bitrate(int argc, char **argv) {
+    uint32_t bitrate;
+    if (argc != 2 || !_parse_u32(argv[1], &bitrate)) {
+        return _usage("bitrate <25000|50000|100000|125000|250000|500000|800000|1000000>");
+    }
+    for (const twai_timing_config_t &timing : console_timings) {
+        if (twai_timing_bitrate(&timing) == bitrate) {
+            console_config.t_config = timing;
+            return 0;
+        }
+    }
+    printf("no standard timing for %lu bit/s, use timing\n", bitrate);
+    return 1;
+}
+
+static int _cmd_timing(int argc, char **argv) {
+    uint32_t brp, tseg_1, tseg_2, sjw;
+    if ((argc != 5 && argc != 6) || !_parse_u32(argv[1], &brp) ||
+        !_parse_u32(argv[2], &tseg_1) || !_parse_u32(argv[3], &tseg_2) ||
+        !_parse_u32(argv[4], &sjw) || (argc == 6 && strcmp(argv[5], "triple") != 0) ||
+        brp < 2 || brp > 128 || brp % 2 != 0 || tseg_1 < 1 || tseg_1 > 16 || tseg_2 < 1 ||
+        tseg_2 > 8 || sjw < 1 || sjw > 4 || sjw > tseg_2) {
+        return _usage(
+            "timing <brp> <tseg1> <tseg2> <sjw> [triple], even brp 2..128, tseg1 1..16, tseg2 "
+            "1..8, sjw 1..min(4, tseg2)");
+    }
+    twai_timing_config_t *timing = &console_config.t_config;
+    *timing = {};
+    timing->clk_src = TWAI_CLK_SRC_DEFAULT;
+    timing->brp = brp;   // Used by the driver as quanta_resolution_hz is 0
+    timing->tseg_1 = tseg_1;
+    timing->tseg_2 = tseg_2;
+    timing->sjw = sjw;
+    timing->triple_sampling = argc == 6;
+    return 0;
+}
+
+static int _cmd_gpio(int argc, char **argv) {
+    uint32_t tx, rx;
+    if (argc != 3 || !_parse_u32(argv[1], &tx) || !_parse_u32(argv[2], &rx) ||
+        !GPIO_IS_VALID_OUTPUT_GPIO((gpio_num_t)tx) || !GPIO_IS_VALID_GPIO((gpio_num_t)rx)) {
+        return _usage("gpio <tx> <rx>");
+    }
+    console_config.g_config.tx_io = (gpio_num_t)tx;
+    console_config.g_config.rx_io = (gpio_num_t)rx;
+    return 0;
+}
+
+static int _cmd_queues(int argc, char **argv) {
+    uint32_t tx, rx;
+    if (argc != 3 || !_parse_u32(argv[1], &tx) || !_parse_u32(argv[2], &rx) || rx == 0) {
+        return _usage("queues <tx_len> <rx_len>, tx_len 0 disables transmission");
+    }
+    console_config.g_config.tx_queue_len = tx;
+    console_config.g_config.rx_queue_len = rx;
+    return 0;
+}
+
+static int _cmd_filter(int argc, char **argv) {
+    const char *usage = "filter all | filter <code> <mask> [single|dual]";
+    twai_filter_config_t *filter = &console_config.f_config;
+    if (argc == 2 && strcmp(argv[1], "all") == 0) {
+        *filter = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+        return 0;
+    }
+    uint32_t code, mask;
+    if ((argc != 3 && argc != 4) || !_parse_u32(argv[1], &code) || !_parse_u32(argv[2], &mask)) {
+        return _usage(usage);
+    }
+    bool single = true;
+    if (argc == 4) {
+        if (strcmp(argv[3], "dual") == 0) {
+            single = false;
+        } else if (strcmp(argv[3], "single") != 0) {
+            return _usage(usage);
+        }
+    }
+    filter->acceptance_code = code;
+    filter->acceptance_mask = mask;
+    filter->single_filter = single;
+    return 0;
+}
+
+static int _cmd_mode(int argc, char **argv) {
+    if (argc == 2) {
+        for (size_t i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); ++i) {
+            if (strcmp(argv[1], mode_names[i]) == 0) {
+                console_config.g_config.mode = (twai_mode_t)i;
+                return 0;
+            }
+        }
+    }
+    return _usage("mode <normal|no_ack|listen>");
+}
+
+static int _cmd_config(int argc, char **argv) {
+    _print_config();
+    printf("applied by driver restart or driver install\n");
+    return 0;
+}
+
+// Transmit loopback frames every load_period_ms, or keep the TX queue full with period 0
+static void _load_task(void *arg) {
+    const int64_t start_us = esp_timer_get_time();
+    uint32_t sent = 0;
+    uint32_t timeouts = 0;
+    TickType_t last_wake = xTaskGetTickCount();
+    while (!load_stop.load(std::memory_order_relaxed)) {
+        if (load_period_ms != 0) {
+            vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(load_period_ms));
+        }
+        loopback_frame_stamp(&load_message, sent);
+        // Not parked in the gate, so "load stop" still works while the driver is taken away
+        esp_err_t res = ESP_ERR_INVALID_STATE;
+        if (driver_gate_try_enter()) {
+            res = twai_transmit(&load_message, pdMS_TO_TICKS(10));
+            driver_gate_leave();
+        }
+        if (res == ESP_OK) {
+            sent++;
+        } else if (res == ESP_ERR_TIMEOUT) {
+            timeouts++;
+        } else {
+            vTaskDelay(pdMS_TO_TICKS(100));   // Stopped or uninstalled from the console
+            last_wake = xTaskGetTickCount();
+        }
+    }
+    const uint32_t elapsed_ms = (esp_timer_get_time() - start_us) / 1000;
+    ESP_LOGI(console_tag, "Load stopped: %lu frames queued in %lu ms (%lu/s), queue timeouts: %lu",
+             sent, elapsed_ms, elapsed_ms != 0 ? (uint32_t)((uint64_t)sent * 1000 / elapsed_ms) : 0,
+             timeouts);
+    load_active.store(false, std::memory_order_release);
+    vTaskDelete(NULL);
+}
+
+static int _cmd_load(int argc, char **argv) {
+    const char *usage = "load start <id> [period_ms] [ext] | load stop";
+    if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        load_stop.store(true, std::memory_order_relaxed);
+        return 0;
+    }
+    uint32_t id;
+    uint32_t period_ms = 0;
+    if (argc < 3 || argc > 5 || strcmp(argv[1], "start") != 0 || !_parse_u32(argv[2], &id) ||
+        (argc >= 4 && !_parse_u32(argv[3], &period_ms)) ||
+        (argc == 5 && strcmp(argv[4], "ext") != 0)) {
+        return _usage(usage);
+    }
+    const bool extd = argc == 5;
+    if (id > (extd ? TWAI_EXTD_ID_MASK : TWAI_STD_ID_MASK)) {
+        return _usage(usage);
+    }
+    if (load_active.load(std::memory_order_acquire)) {
+        printf("load still running, stop it first\n");
+        return 1;
+    }
+    load_message = {};
+    load_message.identifier = id;
+    load_message.data_length_code = LOOPBACK_FRAME_DLC;
+    load_message.extd = extd;
+    load_message.self = console_config.g_config.mode == TWAI_MODE_NO_ACK;
+    load_period_ms = period_ms;
+    load_stop.store(false, std::memory_order_relaxed);
+    load_active.store(true, std::memory_order_relaxed);
+    if (xTaskCreatePinnedToCore(_load_task, "TWAI_load", 3072, NULL, console_config.load_priority,
+                                NULL, console_config.load_core) != pdPASS) {
+        load_active.store(false, std::memory_order_relaxed);
+        return _result("load start", ESP_ERR_NO_MEM);
+    }
+    const uint32_t frame_bits = twai_frame_bits(&load_message, false);
+    printf("load: id 0x%lx, %s, max. %lu frames/s on the bus\n", id,
+           period_ms != 0 ? "periodic" : "queue kept full",
+           twai_max_frame_rate(twai_timing_bitrate(&console_config.t_config), frame_bits));
+    return 0;
+}
+
+static int _cmd_stats(int argc, char **argv) {
+    // Change since the previous stats command
+    static tester_stats_snapshot_t last = {};
+    tester_stats_snapshot_t now;
+    tester_stats_snapshot(&now);
+    tester_stats_print(&now, &last, console_tag);
+    last = now;
+    _print_status();
+    return 0;
+}
+
+#if CONFIG_TWAI_TESTER_INCIDENT_LOG
+static int _cmd_incidents(int argc, char **argv) {
+    if (argc == 1) {
+        incident_log_print(console_tag);
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+        esp_err_t res = incident_log_clear();
+        printf("Incident log cleared: %s\n", esp_err_to_name(res));
+        return res == ESP_OK ? 0 : 1;
+    }
+    printf("Usage: incidents [clear]\n");
+    return 1;
+}
+#endif
+
+static const esp_console_cmd_t console_commands[] = {
+    {.command = "driver",
+     .help = "Control the driver, restart reinstalls it with the edited configuration",
+     .hint = "<start|stop|install|uninstall|restart|status>",
+     .func = _cmd_driver,
+     .argtable = NULL},
+    {.command = "bitrate",
+     .help = "Select a standard bit timing",
+     .hint = "<bit/s>",
+     .func = _cmd_bitrate,
+     .argtable = NULL},
+    {.command = "timing",
+     .help = "Set a custom bit timing",
+     .hint = "<brp> <tseg1> <tseg2> <sjw> [triple]",
+     .func = _cmd_timing,
+     .argtable = NULL},
+    {.command = "gpio",
+     .help = "Set the TX and RX GPIO",
+     .hint = "<tx> <rx>",
+     .func = _cmd_gpio,
+     .argtable = NULL},
+    {.command = "queues",
+     .help = "Set the driver queue lengths",
+     .hint = "<tx_len> <rx_len>",
+     .func = _cmd_queues,
+     .argtable = NULL},
+    {.command = "filter",
+     .help = "Set the acceptance filter",
+     .hint = "all | <code> <mask> [single|dual]",
+     .func = _cmd_filter,
+     .argtable = NULL},
+    {.command = "mode",
+     .help = "Set the controller mode",
+     .hint = "<normal|no_ack|listen>",
+     .func = _cmd_mode,
+     .argtable = NULL},
+    {.command = "config",
+     .help = "Print the edited driver configuration",
+     .hint = NULL,
+     .func = _cmd_config,
+     .argtable = NULL},
+    {.command = "load",
+     .help = "Start or stop the load generator, period 0 keeps the TX queue full",
+     .hint = "start <id> [period_ms] [ext] | stop",
+     .func = _cmd_load,
+     .argtable = NULL},
+    {.command = "stats",
+     .help = "Print the tester counters and the driver status",
+     .hint = NULL,
+     .func = _cmd_stats,
+     .argtable = NULL},
+#if CONFIG_TWAI_TESTER_INCIDENT_LOG
+    {.command = "incidents",
+     .help = "Print the persistent incident log or erase it",
+     .hint = "[clear]",
+     .func = _cmd_incidents,
+     .argtable = NULL},
+#endif
+};
+
+esp_err_t tester_console_start(const tester_console_config_t *config, const char *tag) {
+    console_config = *config;
+    console_tag = tag;
+
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_config.prompt = "twai>";
+    esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    esp_console_repl_t *repl;
+    esp_err_t res = esp_console_new_repl_uart(&uart_config, &repl_config, &repl);
+    if (res == ESP_OK) {
+        res = esp_console_register_help_command();
+    }
+    for (size_t i = 0; res == ESP_OK && i < sizeof(console_commands) / sizeof(console_commands[0]);
+         ++i) {
+        res = esp_console_cmd_register(&console_commands[i]);
+    }
+    if (res == ESP_OK) {
+        res = esp_console_start_repl(repl);
+    }
+    return res;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "driver/twai.h"
+#include "esp_err.h"
+
+// Initial driver configuration of the console and the placement of its tasks
+typedef struct {
+    twai_general_config_t g_config;
+    twai_timing_config_t t_config;
+    twai_filter_config_t f_config;
+    int isr_core;    // Core which installs the driver and so gets its interrupt
+    int load_core;   // Core of the load generator task
+    int load_priority;
+} tester_console_config_t;
+
+// Start an esp_console REPL on the default console UART. Its commands edit a copy of the driver
+// configuration, reinstall the driver with it, run a load generator and print the statistics,
+// so test variations need no new build. Run "help" for the command list. Reports of the tester
+// which derive from the build time configuration, like the expected bus load, are not updated.
+esp_err_t tester_console_start(const tester_console_config_t *config, const char *tag);
@@ -0,0 +1,134 @@
+#include "tester_stats.h"
+
+#include "driver_gate.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+tester_stats_t tester_stats;
+
+static const char *stats_tag;
+static uint32_t stats_interval_ms;
+
+void tester_stats_snapshot(tester_stats_snapshot_t *snapshot) {
+    const std::memory_order order = std::memory_order_relaxed;
+    snapshot->timestamp_us = esp_timer_get_time();
+    snapshot->frames_ok = tester_stats.frames_ok.load(order);
+    snapshot->frames_dlc_error = tester_stats.frames_dlc_error.load(order);
+    snapshot->frames_data_error = tester_stats.frames_data_error.load(order);
+    snapshot->frames_unknown_id = tester_stats.frames_unknown_id.load(order);
+    snapshot->frames_lost = tester_stats.frames_lost.load(order);
+    snapshot->frames_duplicate = tester_stats.frames_duplicate.load(order);
+    snapshot->frames_quarantined = tester_stats.frames_quarantined.load(order);
+    snapshot->max_ring_latency_us = tester_stats.max_ring_latency_us.load(order);
+    snapshot->rx_timeouts = tester_stats.rx_timeouts.load(order);
+    snapshot->rx_errors = tester_stats.rx_errors.load(order);
+    snapshot->rx_last_error = tester_stats.rx_last_error.load(order);
+    snapshot->ring_drops = tester_stats.ring_drops.load(order);
+    snapshot->rx_wakeups = tester_stats.rx_wakeups.load(order);
+    snapshot->rx_max_batch = tester_stats.rx_max_batch.load(order);
+    snapshot->bus_off = tester_stats.bus_off.load(order);
+    snapshot->recoveries = tester_stats.recoveries.load(order);
+    snapshot->controller_resets = tester_stats.controller_resets.load(order);
+    snapshot->fault_injections = tester_stats.fault_injections.load(order);
+    snapshot->rx_missed = tester_stats.rx_missed.load(order);
+    snapshot->rx_overrun = tester_stats.rx_overrun.load(order);
+    snapshot->tx_failed = tester_stats.tx_failed.load(order);
+    snapshot->arb_lost = tester_stats.arb_lost.load(order);
+    snapshot->bus_errors = tester_stats.bus_errors.load(order);
+    snapshot->state = tester_stats.state.load(order);
+    snapshot->tx_error_counter = tester_stats.tx_error_counter.load(order);
+    snapshot->rx_error_counter = tester_stats.rx_error_counter.load(order);
+}
+
+// Add the increase of a driver counter. The driver restarts its counters on reinstall, then the
+// new value is the increase.
+static void _add_driver_delta(std::atomic<uint32_t> *counter, uint32_t *last, uint32_t value) {
+    tester_stats_add(counter, value >= *last ? value - *last : value);
+    *last = value;
+}
+
+static void _fetch_driver_status(twai_status_info_t *last) {
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) != ESP_OK) {
+        return;   // Driver not installed
+    }
+    _add_driver_delta(&tester_stats.rx_missed, &last->rx_missed_count, status.rx_missed_count);
+    _add_driver_delta(&tester_stats.rx_overrun, &last->rx_overrun_count, status.rx_overrun_count);
+    _add_driver_delta(&tester_stats.tx_failed, &last->tx_failed_count, status.tx_failed_count);
+    _add_driver_delta(&tester_stats.arb_lost, &last->arb_lost_count, status.arb_lost_count);
+    _add_driver_delta(&tester_stats.bus_errors, &last->bus_error_count, status.bus_error_count);
+    tester_stats.state.store(status.state, std::memory_order_relaxed);
+    tester_stats.tx_error_counter.store(status.tx_error_counter, std::memory_order_relaxed);
+    tester_stats.rx_error_counter.store(status.rx_error_counter, std::memory_order_relaxed);
+}
+
+void tester_stats_print(const tester_stats_snapshot_t *now, const tester_stats_snapshot_t *last,
+                        const char *tag) {
+    uint32_t corrupt = (now->frames_dlc_error - last->frames_dlc_error) +
+                       (now->frames_data_error - last->frames_data_error);
+    ESP_LOG_LEVEL_LOCAL(corrupt != 0 ? ESP_LOG_ERROR : ESP_LOG_INFO, tag,
+                        "RX ok: %lu (+%lu), dlc err: %lu, data err: %lu, unknown id: %lu (+%lu), "
+                        "E2E lost: %lu (+%lu), E2E dup: %lu, quarantined: %lu (+%lu), timeouts: "
+                        "%lu, errors: %lu, ring drops: %lu, wakeups: %lu (+%lu), max batch: %lu, "
+                        "max ring latency: %lu us",
+                        now->frames_ok, now->frames_ok - last->frames_ok, now->frames_dlc_error,
+                        now->frames_data_error, now->frames_unknown_id,
+                        now->frames_unknown_id - last->frames_unknown_id, now->frames_lost,
+                        now->frames_lost - last->frames_lost, now->frames_duplicate,
+                        now->frames_quarantined,
+                        now->frames_quarantined - last->frames_quarantined, now->rx_timeouts,
+                        now->rx_errors, now->ring_drops, now->rx_wakeups,
+                        now->rx_wakeups - last->rx_wakeups, now->rx_max_batch,
+                        now->max_ring_latency_us);
+    uint32_t lost = (now->rx_missed - last->rx_missed) + (now->rx_overrun - last->rx_overrun);
+    ESP_LOG_LEVEL_LOCAL(lost != 0 ? ESP_LOG_WARN : ESP_LOG_INFO, tag,
+                        "Bus state: %d, TEC: %lu, REC: %lu, rx missed: %lu (+%lu), rx overrun: "
+                        "%lu (+%lu), tx failed: %lu, arb lost: %lu, bus errors: %lu (+%lu), bus "
+                        "off: %lu, recoveries: %lu, controller resets: %lu",
+                        now->state, now->tx_error_counter, now->rx_error_counter, now->rx_missed,
+                        now->rx_missed - last->rx_missed, now->rx_overrun,
+                        now->rx_overrun - last->rx_overrun, now->tx_failed, now->arb_lost,
+                        now->bus_errors, now->bus_errors - last->bus_errors, now->bus_off,
+                        now->recoveries, now->controller_resets);
+    if (now->fault_injections != 0) {
+        // Corruption rate since the start, the frames per injection vary too much per interval
+        const uint32_t corrupt_total = now->frames_dlc_error + now->frames_data_error;
+        const uint64_t per_mille = 1000ull * corrupt_total / now->fault_injections;
+        ESP_LOGI(tag,
+                 "Fault injections: %lu (+%lu), corrupt frames: %lu, %lu per 1000 injections, "
+                 "bus off per 1000 injections: %lu",
+                 now->fault_injections, now->fault_injections - last->fault_injections,
+                 corrupt_total, (uint32_t)per_mille,
+                 (uint32_t)(1000ull * now->bus_off / now->fault_injections));
+    }
+}
+
+static void stats_task(void *arg) {
+    twai_status_info_t last_status = {};
+    tester_stats_snapshot_t reported = {};
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(stats_interval_ms));
+        driver_gate_enter();
+        _fetch_driver_status(&last_status);
+        driver_gate_leave();
+
+        tester_stats_snapshot_t now;
+        tester_stats_snapshot(&now);
+        tester_stats_print(&now, &reported, stats_tag);
+        reported = now;
+    }
+}
+
+esp_err_t tester_stats_start_reporter(const char *tag, uint32_t interval_ms, int core,
+                                      int priority) {
+    stats_tag = tag;
+    stats_interval_ms = interval_ms;
+    if (xTaskCreatePinnedToCore(stats_task, "TWAI_stats", 4096, NULL, priority, NULL, core) !=
+        pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
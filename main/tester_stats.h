@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "driver/twai.h"
+#include "esp_err.h"
+
+// Health counters of the tester. Every counter has exactly one writing task, so it is updated
+// with a relaxed load and store instead of a locked read-modify-write, and any task may read it.
+typedef struct {
+    // Analysis task
+    std::atomic<uint32_t> frames_ok;
+    std::atomic<uint32_t> frames_dlc_error;
+    std::atomic<uint32_t> frames_data_error;
+    std::atomic<uint32_t> frames_unknown_id;
+    std::atomic<uint32_t> frames_lost;          // Skipped E2E counter values
+    std::atomic<uint32_t> frames_duplicate;     // Repeated E2E counter values
+    std::atomic<uint32_t> frames_quarantined;   // Not validated, see controller_health.h
+    std::atomic<uint32_t> max_ring_latency_us;   // Max. time a frame waited for the analysis task
+    // RX task
+    std::atomic<uint32_t> rx_timeouts;
+    std::atomic<uint32_t> rx_errors;
+    std::atomic<esp_err_t> rx_last_error;
+    std::atomic<uint32_t> ring_drops;   // Frames lost because the analysis task fell behind
+    std::atomic<uint32_t> rx_wakeups;
+    std::atomic<uint32_t> rx_max_batch;
+    // Control task
+    std::atomic<uint32_t> bus_off;
+    std::atomic<uint32_t> recoveries;
+    std::atomic<uint32_t> controller_resets;   // Restarts by the controller health watchdog
+    // esp_timer task
+    std::atomic<uint32_t> fault_injections;
+    // Reporter task, accumulated from twai_get_status_info() over driver reinstalls
+    std::atomic<uint32_t> rx_missed;
+    std::atomic<uint32_t> rx_overrun;
+    std::atomic<uint32_t> tx_failed;
+    std::atomic<uint32_t> arb_lost;
+    std::atomic<uint32_t> bus_errors;
+    std::atomic<twai_state_t> state;
+    std::atomic<uint32_t> tx_error_counter;
+    std::atomic<uint32_t> rx_error_counter;
+} tester_stats_t;
+
+// Plain copy of tester_stats_t
+typedef struct {
+    int64_t timestamp_us;
+    uint32_t frames_ok;
+    uint32_t frames_dlc_error;
+    uint32_t frames_data_error;
+    uint32_t frames_unknown_id;
+    uint32_t frames_lost;
+    uint32_t frames_duplicate;
+    uint32_t frames_quarantined;
+    uint32_t max_ring_latency_us;
+    uint32_t rx_timeouts;
+    uint32_t rx_errors;
+    esp_err_t rx_last_error;
+    uint32_t ring_drops;
+    uint32_t rx_wakeups;
+    uint32_t rx_max_batch;
+    uint32_t bus_off;
+    uint32_t recoveries;
+    uint32_t controller_resets;
+    uint32_t fault_injections;
+    uint32_t rx_missed;
+    uint32_t rx_overrun;
+    uint32_t tx_failed;
+    uint32_t arb_lost;
+    uint32_t bus_errors;
+    twai_state_t state;
+    uint32_t tx_error_counter;
+    uint32_t rx_error_counter;
+} tester_stats_snapshot_t;
+
+extern tester_stats_t tester_stats;
+
+// Add to a counter. Must only be called by the task owning the counter.
+static inline void tester_stats_add(std::atomic<uint32_t> *counter, uint32_t value) {
+    counter->store(counter->load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+// Raise a maximum. Must only be called by the task owning the counter.
+static inline void tester_stats_max(std::atomic<uint32_t> *counter, uint32_t value) {
+    if (value > counter->load(std::memory_order_relaxed)) {
+        counter->store(value, std::memory_order_relaxed);
+    }
+}
+
+// Copy all counters. The copy is not atomic as a whole, but each counter is consistent.
+void tester_stats_snapshot(tester_stats_snapshot_t *snapshot);
+
+// Print the counters and their change since last
+void tester_stats_print(const tester_stats_snapshot_t *now, const tester_stats_snapshot_t *last,
+                        const char *tag);
+
+// Start the task which fetches the driver counters and prints the change of all counters every
+// interval_ms
+esp_err_t tester_stats_start_reporter(const char *tag, uint32_t interval_ms, int core,
+                                      int priority);
@@ -0,0 +1,135 @@
+#include "tx_scheduler.h"
+
+#include "sdkconfig.h"
+
+#if CONFIG_TWAI_TESTER_TX_MODE_SCHEDULER
+
+#include "driver_gate.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "jitter_histogram.h"
+
+#define TX_SCHED_MAX_MESSAGES CONFIG_TWAI_TESTER_TX_SCHED_MAX_MESSAGES
+
+// Histogram of the deviation of the measured from the configured period
+typedef JitterHistogram<CONFIG_TWAI_TESTER_TX_SCHED_JITTER_BUCKET_US, 100> tx_period_jitter_t;
+
+typedef struct {
+    const tx_cyclic_message_t *cyclic;
+    esp_timer_handle_t timer;
+    int64_t last_call_us;
+    uint32_t min_period_us;
+    uint32_t max_period_us;
+    uint32_t sent;
+    uint32_t queue_full;   // Driver TX queue was full when the message was due
+    uint32_t errors;
+    tx_period_jitter_t jitter;
+} tx_sched_entry_t;
+
+static tx_sched_entry_t tx_sched_entries[TX_SCHED_MAX_MESSAGES];
+static size_t tx_sched_count;
+
+// Protects the statistics between the esp_timer task and the reporting task
+static portMUX_TYPE tx_sched_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void _tx_sched_callback(void *arg) {
+    tx_sched_entry_t *entry = (tx_sched_entry_t *)arg;
+    const int64_t now_us = esp_timer_get_time();
+    esp_err_t res = ESP_ERR_INVALID_STATE;   // Driver taken by the console
+    if (driver_gate_try_enter()) {
+        res = twai_transmit(&entry->cyclic->message, 0);
+        driver_gate_leave();
+    }
+
+    portENTER_CRITICAL(&tx_sched_lock);
+    if (entry->last_call_us != 0) {
+        const uint32_t period_us = now_us - entry->last_call_us;
+        const uint32_t expected_us = entry->cyclic->period_us;
+        entry->jitter.add(period_us > expected_us ? period_us - expected_us
+                                                  : expected_us - period_us);
+        if (entry->min_period_us == 0 || period_us < entry->min_period_us) {
+            entry->min_period_us = period_us;
+        }
+        if (period_us > entry->max_period_us) {
+            entry->max_period_us = period_us;
+        }
+    }
+    entry->last_call_us = now_us;
+
+    if (res == ESP_OK) {
+        entry->sent++;
+    } else if (res == ESP_ERR_TIMEOUT) {
+        entry->queue_full++;
+    } else {
+        entry->errors++;
+    }
+    portEXIT_CRITICAL(&tx_sched_lock);
+}
+
+esp_err_t tx_scheduler_start(const tx_cyclic_message_t *messages, size_t count) {
+    if (tx_sched_count != 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (count > TX_SCHED_MAX_MESSAGES) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        tx_sched_entry_t *entry = &tx_sched_entries[i];
+        *entry = {};
+        entry->cyclic = &messages[i];
+
+        const esp_timer_create_args_t timer_args = {.callback = _tx_sched_callback,
+                                                    .arg = entry,
+                                                    .dispatch_method = ESP_TIMER_TASK,
+                                                    .name = "tx_sched",
+                                                    .skip_unhandled_events = false};
+        esp_err_t res = esp_timer_create(&timer_args, &entry->timer);
+        if (res == ESP_OK) {
+            res = esp_timer_start_periodic(entry->timer, messages[i].period_us);
+        }
+        if (res != ESP_OK) {
+            tx_sched_count = i + 1;
+            tx_scheduler_stop();
+            return res;
+        }
+    }
+    tx_sched_count = count;
+    return ESP_OK;
+}
+
+void tx_scheduler_stop(void) {
+    for (size_t i = 0; i < tx_sched_count; ++i) {
+        if (tx_sched_entries[i].timer != NULL) {
+            esp_timer_stop(tx_sched_entries[i].timer);
+            esp_timer_delete(tx_sched_entries[i].timer);
+            tx_sched_entries[i].timer = NULL;
+        }
+    }
+    tx_sched_count = 0;
+}
+
+void tx_scheduler_print_stats(const char *tag) {
+    for (size_t i = 0; i < tx_sched_count; ++i) {
+        tx_sched_entry_t *entry = &tx_sched_entries[i];
+
+        // Copy and restart the statistics, print outside of the critical section
+        portENTER_CRITICAL(&tx_sched_lock);
+        const tx_sched_entry_t snapshot = *entry;
+        entry->jitter.reset();
+        entry->min_period_us = 0;
+        entry->max_period_us = 0;
+        portEXIT_CRITICAL(&tx_sched_lock);
+
+        ESP_LOGI(tag,
+                 "TX 0x%lx every %lu us: sent: %lu, queue full: %lu, errors: %lu, period: "
+                 "%lu-%lu us, jitter mean: %lu us, p99: %lu us, max: %lu us",
+                 snapshot.cyclic->message.identifier, snapshot.cyclic->period_us, snapshot.sent,
+                 snapshot.queue_full, snapshot.errors, snapshot.min_period_us,
+                 snapshot.max_period_us, snapshot.jitter.mean_us(),
+                 snapshot.jitter.percentile_us(990), snapshot.jitter.max_us());
+    }
+}
+
+#endif   // CONFIG_TWAI_TESTER_TX_MODE_SCHEDULER
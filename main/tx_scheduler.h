@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "driver/twai.h"
+#include "esp_err.h"
+
+// Message which is transmitted cyclically by the TX scheduler
+typedef struct {
+    twai_message_t message;
+    uint32_t period_us;
+} tx_cyclic_message_t;
+
+// Start one drift-free periodic esp_timer per message. Every timer callback queues its message
+// without blocking, so periods down to a few hundred microseconds are possible. The messages
+// must stay valid until tx_scheduler_stop() is called.
+esp_err_t tx_scheduler_start(const tx_cyclic_message_t *messages, size_t count);
+
+// Stop and delete all timers of the scheduler
+void tx_scheduler_stop(void);
+
+// Print the period jitter and counters of each message and restart the statistics
+void tx_scheduler_print_stats(const char *tag);
@@ -0,0 +1,344 @@
+#include "udp_gateway.h"
+
+#include "sdkconfig.h"
+
+#if CONFIG_TWAI_TESTER_UDP
+
+#include <errno.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "nvs_flash.h"
+
+#define UDP_HOST CONFIG_TWAI_TESTER_UDP_HOST
+#define UDP_PORT CONFIG_TWAI_TESTER_UDP_PORT
+#define UDP_FRAMES_PER_DATAGRAM CONFIG_TWAI_TESTER_UDP_FRAMES_PER_DATAGRAM
+#define UDP_FLUSH_MS CONFIG_TWAI_TESTER_UDP_FLUSH_MS
+#define UDP_DATAGRAMS CONFIG_TWAI_TESTER_UDP_DATAGRAMS
+#define UDP_REPORT_INTERVAL_MS 10000
+
+#define UDP_MAX_FRAME_SIZE (4 + 1 + TWAI_FRAME_MAX_DLC)
+#define UDP_DATAGRAM_SIZE \
+    (sizeof(udp_gateway_header_t) + UDP_FRAMES_PER_DATAGRAM * UDP_MAX_FRAME_SIZE)
+
+// SocketCAN ID flags and error classes, see linux/can.h and linux/can/error.h
+#define CAN_EFF_FLAG 0x80000000u
+#define CAN_RTR_FLAG 0x40000000u
+#define CAN_ERR_FLAG 0x20000000u
+#define CAN_ERR_TX_TIMEOUT 0x001u
+#define CAN_ERR_LOSTARB 0x002u
+#define CAN_ERR_CRTL 0x004u
+#define CAN_ERR_BUSOFF 0x040u
+#define CAN_ERR_BUSERROR 0x080u
+#define CAN_ERR_RESTARTED 0x100u
+#define CAN_ERR_CRTL_RX_OVERFLOW 0x01
+#define CAN_ERR_CRTL_RX_WARNING 0x04
+#define CAN_ERR_CRTL_TX_WARNING 0x08
+#define CAN_ERR_CRTL_RX_PASSIVE 0x10
+#define CAN_ERR_CRTL_TX_PASSIVE 0x20
+
+#define WIFI_CONNECTED_BIT BIT0
+
+static const char *TAG = "TWAI udp";
+
+typedef struct {
+    uint8_t data[UDP_DATAGRAM_SIZE];
+    size_t len;
+    uint16_t frames;
+    int64_t first_us;   // Timestamp of the first frame, starts the flush deadline
+} udp_datagram_t;
+
+// Ring of datagrams: producers encode into udp_fill, the sender task sends the udp_ready completed
+// ones starting at udp_send. A completed datagram is only touched by the sender.
+static udp_datagram_t udp_datagrams[UDP_DATAGRAMS];
+static size_t udp_fill;
+static size_t udp_send;
+static size_t udp_ready;
+static uint8_t udp_sequence;
+static uint32_t udp_dropped;   // Frames dropped because all datagrams were in use
+static portMUX_TYPE udp_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t udp_task_handle;
+static EventGroupHandle_t wifi_events;
+
+static void _put_be32(uint8_t *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+// Complete the datagram being filled and move on to the next one, unless it is empty or no
+// datagram is left. Must be called with udp_lock held.
+static bool _complete_locked(void) {
+    udp_datagram_t *datagram = &udp_datagrams[udp_fill];
+    if (datagram->frames == 0 || udp_ready == UDP_DATAGRAMS - 1) {
+        return false;
+    }
+    udp_gateway_header_t *header = (udp_gateway_header_t *)datagram->data;
+    header->version = UDP_GATEWAY_VERSION;
+    header->op_code = UDP_GATEWAY_OP_DATA;
+    header->sequence = udp_sequence++;
+    header->count = __builtin_bswap16(datagram->frames);
+    udp_ready++;
+    udp_fill = (udp_fill + 1) % UDP_DATAGRAMS;
+    udp_datagrams[udp_fill].frames = 0;
+    return true;
+}
+
+static void _write(uint32_t can_id, uint8_t len, const uint8_t *data, int64_t timestamp_us) {
+    bool notify = false;
+    if (udp_task_handle == NULL) {
+        return;   // Not started
+    }
+
+    portENTER_CRITICAL(&udp_lock);
+    udp_datagram_t *datagram = &udp_datagrams[udp_fill];
+    if (datagram->frames == UDP_FRAMES_PER_DATAGRAM) {
+        notify = _complete_locked();   // Retry, the sender was behind on the last frame
+        datagram = &udp_datagrams[udp_fill];
+    }
+    if (datagram->frames == UDP_FRAMES_PER_DATAGRAM) {
+        udp_dropped++;
+    } else {
+        if (datagram->frames == 0) {
+            datagram->len = sizeof(udp_gateway_header_t);
+            datagram->first_us = timestamp_us;
+        }
+        uint8_t *out = &datagram->data[datagram->len];
+        _put_be32(out, can_id);
+        out[4] = len;
+        if (!(can_id & CAN_RTR_FLAG)) {
+            memcpy(&out[5], data, len);
+            datagram->len += len;
+        }
+        datagram->len += 5;
+        datagram->frames++;
+        if (datagram->frames == UDP_FRAMES_PER_DATAGRAM) {
+            notify |= _complete_locked();
+        }
+    }
+    portEXIT_CRITICAL(&udp_lock);
+
+    if (notify) {
+        xTaskNotifyGive(udp_task_handle);
+    }
+}
+
+void udp_gateway_write_frame(const twai_message_t *message, int64_t timestamp_us) {
+    uint32_t can_id = message->identifier;
+    if (message->extd) {
+        can_id |= CAN_EFF_FLAG;
+    }
+    if (message->rtr) {
+        can_id |= CAN_RTR_FLAG;
+    }
+    const uint8_t len = message->data_length_code <= TWAI_FRAME_MAX_DLC
+                            ? message->data_length_code
+                            : TWAI_FRAME_MAX_DLC;
+    _write(can_id, len, message->data, timestamp_us);
+}
+
+void udp_gateway_write_alerts(uint32_t alerts, int64_t timestamp_us) {
+    uint32_t can_id = 0;
+    uint8_t data[TWAI_FRAME_MAX_DLC] = {};
+    if (alerts & TWAI_ALERT_TX_FAILED) {
+        can_id |= CAN_ERR_TX_TIMEOUT;
+    }
+    if (alerts & TWAI_ALERT_ARB_LOST) {
+        can_id |= CAN_ERR_LOSTARB;
+    }
+    if (alerts & (TWAI_ALERT_RX_QUEUE_FULL | TWAI_ALERT_RX_FIFO_OVERRUN)) {
+        data[1] |= CAN_ERR_CRTL_RX_OVERFLOW;
+    }
+    if (alerts & TWAI_ALERT_ABOVE_ERR_WARN) {
+        data[1] |= CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING;
+    }
+    if (alerts & TWAI_ALERT_ERR_PASS) {
+        data[1] |= CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE;
+    }
+    if (data[1] != 0) {
+        can_id |= CAN_ERR_CRTL;
+    }
+    if (alerts & TWAI_ALERT_BUS_OFF) {
+        can_id |= CAN_ERR_BUSOFF;
+    }
+    if (alerts & TWAI_ALERT_BUS_ERROR) {
+        can_id |= CAN_ERR_BUSERROR;
+    }
+    if (alerts & TWAI_ALERT_BUS_RECOVERED) {
+        can_id |= CAN_ERR_RESTARTED;
+    }
+    if (can_id != 0) {
+        _write(can_id | CAN_ERR_FLAG, sizeof(data), data, timestamp_us);
+    }
+}
+
+// Complete the datagram being filled if its first frame reached the flush deadline. Returns the
+// time until the deadline otherwise.
+static TickType_t _flush_if_due(void) {
+    const int64_t deadline_us = UDP_FLUSH_MS * 1000LL;
+    int64_t age_us = 0;
+    portENTER_CRITICAL(&udp_lock);
+    const udp_datagram_t *datagram = &udp_datagrams[udp_fill];
+    if (datagram->frames != 0) {
+        age_us = esp_timer_get_time() - datagram->first_us;
+        if (age_us >= deadline_us && _complete_locked()) {
+            age_us = 0;
+        }
+    }
+    portEXIT_CRITICAL(&udp_lock);
+    TickType_t wait = pdMS_TO_TICKS((deadline_us - age_us) / 1000);
+    return wait > 0 ? wait : 1;
+}
+
+// Send all completed datagrams, or drop them while the station has no address or without a
+// usable socket
+static void udp_task(void *arg) {
+    struct sockaddr_in dest = {};
+    dest.sin_family = AF_INET;
+    dest.sin_port = htons(UDP_PORT);
+    bool usable = true;
+    if (inet_pton(AF_INET, UDP_HOST, &dest.sin_addr) != 1) {
+        ESP_LOGE(TAG, "Invalid host IPv4 address \"%s\", all frames are dropped", UDP_HOST);
+        usable = false;
+    }
+    const int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Could not create the socket: errno %d, all frames are dropped", errno);
+        usable = false;
+    }
+
+    uint32_t sent = 0;
+    uint32_t sent_frames = 0;
+    uint32_t errors = 0;
+    uint32_t offline = 0;   // Frames dropped while not connected or without a usable socket
+    uint32_t reported_sent = 0;
+    TickType_t last_report = xTaskGetTickCount();
+
+    TickType_t wait = pdMS_TO_TICKS(UDP_FLUSH_MS);
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, wait);
+        wait = _flush_if_due();
+
+        const bool connected = usable && (xEventGroupGetBits(wifi_events) & WIFI_CONNECTED_BIT);
+        portENTER_CRITICAL(&udp_lock);
+        size_t ready = udp_ready;
+        portEXIT_CRITICAL(&udp_lock);
+        for (; ready != 0; --ready) {
+            const udp_datagram_t *datagram = &udp_datagrams[udp_send];
+            const uint16_t frames = __builtin_bswap16(
+                ((const udp_gateway_header_t *)datagram->data)->count);
+            if (!connected) {
+                offline += frames;
+            } else if (sendto(sock, datagram->data, datagram->len, 0, (struct sockaddr *)&dest,
+                              sizeof(dest)) < 0) {
+                errors++;
+            } else {
+                sent++;
+                sent_frames += frames;
+            }
+            udp_send = (udp_send + 1) % UDP_DATAGRAMS;
+            portENTER_CRITICAL(&udp_lock);
+            udp_ready--;
+            portEXIT_CRITICAL(&udp_lock);
+        }
+
+        const TickType_t now = xTaskGetTickCount();
+        if (now - last_report >= pdMS_TO_TICKS(UDP_REPORT_INTERVAL_MS)) {
+            portENTER_CRITICAL(&udp_lock);
+            const uint32_t dropped = udp_dropped;
+            portEXIT_CRITICAL(&udp_lock);
+            ESP_LOGI(TAG,
+                     "Datagrams: %lu (+%lu), frames: %lu, avg. %lu frames/datagram, send "
+                     "errors: %lu, dropped offline: %lu, dropped full: %lu",
+                     sent, sent - reported_sent, sent_frames, sent ? sent_frames / sent : 0,
+                     errors, offline, dropped);
+            reported_sent = sent;
+            last_report = now;
+        }
+    }
+}
+
+static void _wifi_event_handler(void *arg, esp_event_base_t base, int32_t id, void *data) {
+    if (base == WIFI_EVENT && (id == WIFI_EVENT_STA_START || id == WIFI_EVENT_STA_DISCONNECTED)) {
+        xEventGroupClearBits(wifi_events, WIFI_CONNECTED_BIT);
+        esp_wifi_connect();
+    } else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+        ESP_LOGI(TAG, "Connected, sending to %s:%d", UDP_HOST, UDP_PORT);
+        xEventGroupSetBits(wifi_events, WIFI_CONNECTED_BIT);
+    }
+}
+
+// Bring up the Wi-Fi station, it reconnects on its own after each disconnect
+static esp_err_t _wifi_start(void) {
+    esp_err_t res = nvs_flash_init();
+    if (res == ESP_ERR_NVS_NO_FREE_PAGES || res == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        nvs_flash_erase();
+        res = nvs_flash_init();
+    }
+    if (res == ESP_OK) {
+        res = esp_netif_init();
+    }
+    if (res == ESP_OK) {
+        res = esp_event_loop_create_default();
+    }
+    if (res != ESP_OK) {
+        return res;
+    }
+    esp_netif_create_default_wifi_sta();
+
+    const wifi_init_config_t init_config = WIFI_INIT_CONFIG_DEFAULT();
+    wifi_config_t wifi_config = {};
+    strlcpy((char *)wifi_config.sta.ssid, CONFIG_TWAI_TESTER_UDP_WIFI_SSID,
+            sizeof(wifi_config.sta.ssid));
+    strlcpy((char *)wifi_config.sta.password, CONFIG_TWAI_TESTER_UDP_WIFI_PASSWORD,
+            sizeof(wifi_config.sta.password));
+    res = esp_wifi_init(&init_config);
+    if (res == ESP_OK) {
+        res = esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, _wifi_event_handler, NULL);
+    }
+    if (res == ESP_OK) {
+        res = esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, _wifi_event_handler, NULL);
+    }
+    if (res == ESP_OK) {
+        res = esp_wifi_set_mode(WIFI_MODE_STA);
+    }
+    if (res == ESP_OK) {
+        res = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    }
+    if (res == ESP_OK) {
+        res = esp_wifi_start();
+    }
+    return res;
+}
+
+esp_err_t udp_gateway_start(int core, int priority) {
+    wifi_events = xEventGroupCreate();
+    if (wifi_events == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t res = _wifi_start();
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Could not start Wi-Fi: %s", esp_err_to_name(res));
+        return res;
+    }
+
+    if (xTaskCreatePinnedToCore(udp_task, "TWAI_udp", 3072, NULL, priority, &udp_task_handle,
+                                core) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "UDP gateway to %s:%d, %d frames or %d ms per datagram", UDP_HOST, UDP_PORT,
+             UDP_FRAMES_PER_DATAGRAM, UDP_FLUSH_MS);
+    return ESP_OK;
+}
+
+#endif   // CONFIG_TWAI_TESTER_UDP
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/twai.h"
+#include "esp_err.h"
+
+// Datagram framing of cannelloni (https://github.com/mguentner/cannelloni), so a Linux host
+// bridges the stream into a SocketCAN interface. All multi-byte fields are big endian.
+#define UDP_GATEWAY_VERSION 2
+#define UDP_GATEWAY_OP_DATA 0
+
+// Datagram header, followed by count frames of 4 byte SocketCAN ID (with the EFF/RTR/ERR flags),
+// 1 byte length and the data bytes, which are left out for remote frames
+typedef struct __attribute__((packed)) {
+    uint8_t version;    // UDP_GATEWAY_VERSION
+    uint8_t op_code;    // UDP_GATEWAY_OP_DATA
+    uint8_t sequence;   // Incremented per datagram
+    uint16_t count;     // Number of frames in the datagram
+} udp_gateway_header_t;
+static_assert(sizeof(udp_gateway_header_t) == 5, "Header layout is part of the host protocol");
+
+// Connect to the Wi-Fi network and start the sender task. Datagrams completed before the
+// station got its address are dropped and counted.
+esp_err_t udp_gateway_start(int core, int priority);
+
+// Encode a frame straight into the datagram being filled. Safe to call from any task, never
+// blocks. A datagram is sent once it holds the configured number of frames or its first frame
+// is older than the flush deadline. Frames are dropped and counted if all datagrams are in use.
+void udp_gateway_write_frame(const twai_message_t *message, int64_t timestamp_us);
+
+// Forward alerts as SocketCAN error frame, alerts without a SocketCAN equivalent are skipped
+void udp_gateway_write_alerts(uint32_t alerts, int64_t timestamp_us);
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Compare benchmark suite logs of the TWAI tester (CONFIG_TWAI_TESTER_BENCH_SUITE).
+
+Extracts the BENCH lines from one or more console logs and prints a table per metric with one
+column per log, so runs with different ESP-IDF versions or errata settings line up by scenario
+and bitrate. With --csv the parsed runs are written as one CSV instead.
+
+    twai_bench_compare.py idf-5.3.1.log idf-5.4.log
+    twai_bench_compare.py --csv idf-5.3.1.log > runs.csv
+"""
+
+import argparse
+import csv
+import sys
+
+KEY_COLUMNS = ('scenario', 'bitrate', 'load_pct')
+DEFAULT_METRICS = ('frames_per_s', 'lost', 'rx_missed', 'rx_overrun', 'bus_off',
+                   'max_recovery_ms', 'lat_p50_us', 'lat_p99_us', 'lat_max_us', 'cpu0_permille',
+                   'cpu1_permille', 'rx_task_permille', 'tx_task_permille')
+
+
+def parse_log(path):
+    """Return the BENCH_INFO fields and the runs of a log as dicts"""
+    info = {}
+    header = None
+    runs = []
+    with open(path, errors='replace') as log:
+        for line in log:
+            # Skip the log prefix and the color codes around the message
+            pos = line.find('BENCH')
+            if pos < 0:
+                continue
+            fields = line[pos:].strip().split('\x1b')[0].split(',')
+            if fields[0] == 'BENCH_INFO':
+                info = dict(field.split('=', 1) for field in fields[1:] if '=' in field)
+            elif fields[0] == 'BENCH' and fields[1] == 'scenario':
+                header = fields[1:]
+            elif fields[0] == 'BENCH' and header is not None and len(fields) == len(header) + 1:
+                runs.append(dict(zip(header, fields[1:])))
+    return info, runs
+
+
+def _label(path, info):
+    return '%s (%s)' % (path, info.get('idf', '?'))
+
+
+def print_tables(logs, metrics):
+    keys = []
+    for _, _, runs in logs:
+        for run in runs:
+            key = tuple(run[column] for column in KEY_COLUMNS)
+            if key not in keys:
+                keys.append(key)
+
+    width = max([12] + [len(_label(path, info)) for path, info, _ in logs])
+    for info_field in sorted({field for _, info, _ in logs for field in info}):
+        values = [info.get(info_field, '-') for _, info, _ in logs]
+        if len(set(values)) > 1:
+            print('%-26s' % info_field + ''.join('%*s' % (width + 2, v) for v in values))
+
+    for metric in metrics:
+        print()
+        print('%-26s' % metric + ''.join('%*s' % (width + 2, _label(path, info))
+                                         for path, info, _ in logs))
+        for key in keys:
+            row = []
+            for _, _, runs in logs:
+                match = [run for run in runs
+                         if tuple(run[column] for column in KEY_COLUMNS) == key]
+                row.append(match[0].get(metric, '-') if match else '-')
+            print('%-26s' % ('%s@%s' % (key[0], key[1])) +
+                  ''.join('%*s' % (width + 2, value) for value in row))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('logs', nargs='+', help='console logs with BENCH lines')
+    parser.add_argument('--metric', action='append',
+                        help='metric to compare, may be repeated (default: all main metrics)')
+    parser.add_argument('--csv', action='store_true', help='write all runs as CSV to stdout')
+    args = parser.parse_args()
+
+    logs = []
+    for path in args.logs:
+        info, runs = parse_log(path)
+        if not runs:
+            print('%s: no BENCH lines' % path, file=sys.stderr)
+        logs.append((path, info, runs))
+
+    if args.csv:
+        columns = set()
+        for _, info, runs in logs:
+            for run in runs:
+                columns.update(run)
+        columns = list(KEY_COLUMNS) + sorted(columns - set(KEY_COLUMNS))
+        writer = csv.writer(sys.stdout)
+        writer.writerow(['log', 'idf'] + columns)
+        for path, info, runs in logs:
+            for run in runs:
+                writer.writerow([path, info.get('idf', '')] + [run.get(c, '') for c in columns])
+        return
+
+    print_tables(logs, args.metric or DEFAULT_METRICS)
+
+
+if __name__ == '__main__':
+    main()
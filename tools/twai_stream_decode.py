@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+"""Decode the binary frame stream of the TWAI tester (CONFIG_TWAI_TESTER_STREAM).
+
+Reads the stream from a file, stdin or a serial port and writes a candump log or a PCAP file
+(LINKTYPE_CAN_SOCKETCAN), which can be replayed with can-utils or opened in Wireshark.
+
+    twai_stream_decode.py capture.bin > capture.log
+    twai_stream_decode.py --serial /dev/ttyUSB1 --baudrate 2000000 --pcap capture.pcap
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0xA5
+RECORD_SIZE = 24
+RECORD = struct.Struct('<BBHIIBB8sH')
+
+TYPE_FRAME = 1
+TYPE_ALERTS = 2
+TYPE_DROPPED = 3
+
+# twai_message_t flags
+FLAG_EXTD = 0x01
+FLAG_RTR = 0x02
+
+# SocketCAN ID flags
+CAN_EFF_FLAG = 0x80000000
+CAN_RTR_FLAG = 0x40000000
+
+LINKTYPE_CAN_SOCKETCAN = 227
+
+
+def fletcher16(data):
+    sum1 = 0
+    sum2 = 0
+    for byte in data:
+        sum1 = (sum1 + byte) % 255
+        sum2 = (sum2 + sum1) % 255
+    return (sum2 << 8) | sum1
+
+
+def records(source):
+    """Yield the valid records of a byte stream, resynchronizing on magic byte and checksum."""
+    buffer = bytearray()
+    while True:
+        chunk = source.read(4096)
+        if not chunk:
+            return
+        buffer += chunk
+        pos = 0
+        while len(buffer) - pos >= RECORD_SIZE:
+            if buffer[pos] != MAGIC:
+                pos += 1
+                continue
+            raw = bytes(buffer[pos:pos + RECORD_SIZE])
+            fields = RECORD.unpack(raw)
+            if fields[-1] != fletcher16(raw[:-2]):
+                pos += 1
+                continue
+            yield fields[1:-1]
+            pos += RECORD_SIZE
+        del buffer[:pos]
+
+
+class SerialSource:
+    """Blocking reads of whatever the serial port has received, so slow streams are not delayed"""
+
+    def __init__(self, port):
+        self.port = port
+
+    def read(self, size):
+        return self.port.read(max(1, min(size, self.port.in_waiting)))
+
+
+class CandumpWriter:
+    def __init__(self, out, interface):
+        self.out = out
+        self.interface = interface
+
+    def frame(self, timestamp, identifier, flags, dlc, data):
+        if flags & FLAG_EXTD:
+            can_id = '%08X' % identifier
+        else:
+            can_id = '%03X' % identifier
+        if flags & FLAG_RTR:
+            payload = 'R'
+        else:
+            payload = data[:min(dlc, 8)].hex().upper()
+        self.out.write('(%.6f) %s %s#%s\n' % (timestamp, self.interface, can_id, payload))
+
+
+class PcapWriter:
+    def __init__(self, out):
+        self.out = out
+        # Global header: microsecond resolution, snap length, SocketCAN link type
+        self.out.write(struct.pack('<IHHiIII', 0xA1B2C3D4, 2, 4, 0, 0, 65535,
+                                   LINKTYPE_CAN_SOCKETCAN))
+
+    def frame(self, timestamp, identifier, flags, dlc, data):
+        can_id = identifier
+        if flags & FLAG_EXTD:
+            can_id |= CAN_EFF_FLAG
+        if flags & FLAG_RTR:
+            can_id |= CAN_RTR_FLAG
+        length = min(dlc, 8)
+        # struct can_frame, the ID is in network byte order for LINKTYPE_CAN_SOCKETCAN
+        packet = struct.pack('>I', can_id) + struct.pack('<B3x', length) + data[:8]
+        seconds = int(timestamp)
+        micros = int(round((timestamp - seconds) * 1e6))
+        self.out.write(struct.pack('<IIII', seconds, micros, len(packet), len(packet)))
+        self.out.write(packet)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('input', nargs='?', help='stream file, stdin if omitted')
+    parser.add_argument('--serial', help='read from this serial port instead of a file')
+    parser.add_argument('--baudrate', type=int, default=2000000)
+    parser.add_argument('--pcap', help='write a PCAP file instead of a candump log to stdout')
+    parser.add_argument('--interface', default='can0', help='interface name in the candump log')
+    args = parser.parse_args()
+
+    if args.serial:
+        try:
+            import serial
+        except ImportError:
+            sys.exit('Reading from a serial port requires pyserial')
+        source = SerialSource(serial.Serial(args.serial, args.baudrate, timeout=None))
+    elif args.input:
+        source = open(args.input, 'rb')
+    else:
+        source = sys.stdin.buffer
+
+    if args.pcap:
+        writer = PcapWriter(open(args.pcap, 'wb'))
+    else:
+        writer = CandumpWriter(sys.stdout, args.interface)
+
+    # The device only sends the lower 32 bit of the microsecond timestamp. Frames and alerts are
+    # stamped by different tasks and may arrive slightly out of order, so the full time is
+    # extended by the signed 32 bit difference to the previous record, a wrap is a step back by
+    # more than 2^31 us.
+    time_us = None
+    last_raw = None
+    last_sequence = None
+    frames = 0
+    gaps = 0
+    for rec_type, sequence, timestamp_us, identifier, flags, dlc, data in records(source):
+        if last_sequence is not None and sequence != (last_sequence + 1) & 0xFFFF:
+            gaps += 1
+            sys.stderr.write('Sequence gap: %d -> %d\n' % (last_sequence, sequence))
+        last_sequence = sequence
+
+        if time_us is None:
+            time_us = timestamp_us
+        else:
+            time_us += ((timestamp_us - last_raw + 2**31) % 2**32) - 2**31
+        last_raw = timestamp_us
+        timestamp = time_us / 1e6
+
+        if rec_type == TYPE_FRAME:
+            writer.frame(timestamp, identifier, flags, dlc, data)
+            frames += 1
+        elif rec_type == TYPE_ALERTS:
+            sys.stderr.write('(%.6f) Alerts: 0x%08x\n' % (timestamp, identifier))
+        elif rec_type == TYPE_DROPPED:
+            sys.stderr.write('(%.6f) Device dropped %d records\n' % (timestamp, identifier))
+
+    sys.stderr.write('%d frames, %d sequence gaps\n' % (frames, gaps))
+
+
+if __name__ == '__main__':
+    main()